@@ -0,0 +1,16 @@
+// The camera of the viewport being drawn, set once per viewport per
+// frame and shared by all programs. Matches gl_camera_block_t
+layout (std140) uniform camera_block {
+	mat4 view;
+	mat4 proj;
+	mat4 view_proj;
+	mat4 inv_view;
+	mat4 inv_proj;
+	mat4 inv_view_proj;
+	// w is 1
+	vec4 pos;
+	// In pixels
+	vec2 viewport_size;
+	// Seconds since the start
+	float time;
+} camera;
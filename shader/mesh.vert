@@ -1,14 +1,36 @@
-// As required by immediate mode
+// As required by immediate mode. Where the model matrix comes from is up
+// to the draw: with INSTANCED it's an attribute of each instance, and with
+// MULTI_DRAW (for glMultiDrawElementsIndirect, with the 4.3 prologue) each
+// draw has it in a buffer, found by gl_DrawID
 layout (location = 0) in vec3 vert_pos;
 layout (location = 1) in vec3 vert_norm;
 
-layout (location = 0) uniform mat4 transform = mat4(1.0);
+#include camera.glsl
+
+#if defined(INSTANCED)
+// Takes up locations 4 to 7
+layout (location = 4) in mat4 instance_model;
+#elif defined(MULTI_DRAW)
+// gl_DrawID counts from 0 in every call
+layout (location = 1) uniform int first_draw = 0;
+
+layout (std430, binding = 0) readonly buffer draw_models {
+	mat4 models[];
+};
+#else
+layout (location = 0) uniform mat4 model = mat4(1.0);
+#endif
 
 out float pixel_shade;
 
 void main ()
 {
-	gl_Position = transform * vec4(vert_pos, 1.0);
+#if defined(INSTANCED)
+	mat4 model = instance_model;
+#elif defined(MULTI_DRAW)
+	mat4 model = models[first_draw + gl_DrawIDARB];
+#endif
+	gl_Position = camera.view_proj * model * vec4(vert_pos, 1.0);
 
 	const vec3 dir = normalize(-vec3(0.3, 0.6, 0.7));
 	pixel_shade = dot(dir, vert_norm) * 0.5 + 0.5;
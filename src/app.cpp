@@ -1,24 +1,63 @@
 #include "app.h"
 #include "gl.h"
+#include "gl_camera.h"
 #include "gl_glsl.h"
 #include "gl_immediate.h"
+#include "gui.h"
+#include "mesh_cache.h"
+#include "scene.h"
 #include "util.h"
 
 viewport3d_t viewport;
 
-static GLuint mesh_program;
+static glsl_program_t mesh_program;
+
+static constexpr const char* CAR_MESH_PATH = "car.obj";
+static mesh_t car_mesh;
+static mesh_t prop_mesh;
+
+/*
+ * Boxes on a grid around the car, for something more to draw. The tall
+ * ones are occluders
+ */
+static void add_props ()
+{
+	constexpr int GRID = 20;
+	constexpr float SPACING = 8.0;
+	const aabb_t keep_out = car_mesh.bounds;
+
+	for (int i = 0; i < GRID; i++) {
+		for (int j = 0; j < GRID; j++) {
+			const vec3 pos((i - GRID / 2 + 0.5) * SPACING,
+			               (j - GRID / 2 + 0.5) * SPACING, 0.0);
+			if (pos.x > keep_out.min.x - SPACING && pos.x < keep_out.max.x + SPACING
+			 && pos.y > keep_out.min.y - SPACING && pos.y < keep_out.max.y + SPACING)
+				continue;
+
+			/* Different heights, so that it's not all the same */
+			const vec3 size(2.0, 2.0, 1.0 + (i * 7 + j * 13) % 5);
+			mat4 model = glm::translate(mat4(1.0), pos + vec3(0, 0, size.z / 2));
+			model = glm::scale(model, size);
+			scene_add(&prop_mesh, model, size.z >= 4.0);
+		}
+	}
+}
 
 void app_init ()
 {
-	GLuint shaders[2] = { glsl_load_shader_file(GL_FRAGMENT_SHADER, "mesh.frag"),
-	                      glsl_load_shader_file(GL_VERTEX_SHADER, "mesh.vert") };
-	mesh_program = glsl_link_program(shaders, 2);
-	for (GLuint& s: shaders)
-		glsl_delete_shader(s);
+	mesh_program = glsl_submit_program("mesh.vert", "mesh.frag");
+
+	mesh_arena_init();
+	scene_init();
+	gui_scene_settings = scene_settings;
+	mesh_load_async(car_mesh, CAR_MESH_PATH);
+	prop_mesh = mesh_upload(mesh_data_box(), true);
+	scene_add(&car_mesh, mat4(1.0));
+	add_props();
 
 	viewport.camera =
-		{ .pos = { 2.0, 2.0, 2.0 },
-		  .angles = { 0.0, 180.0, 0.0 },
+		{ .pos = { 50.0, 0.0, 15.0 },
+		  .angles = { -10.0, 180.0, 0.0 },
 		  .fov = 90.0, .aspect = 1.0,
 		  .z_near = 0.5, .z_far = 100.0 };
 }
@@ -26,6 +65,11 @@ void app_init ()
 void app_deinit ()
 {
 	glsl_delete_program(mesh_program);
+	scene_clear();
+	scene_deinit();
+	mesh_destroy(car_mesh);
+	mesh_destroy(prop_mesh);
+	mesh_arena_deinit();
 }
 
 
@@ -72,21 +116,23 @@ void app_update ()
 	}
 }
 
-void viewport3d_t::render () const
+void viewport3d_t::render (int framebuffer_height) const
 {
-	glViewport(this->pos.x,
-	           render_context.resolution_y - this->pos.y - this->size.y,
-	           this->size.x,
-	           this->size.y);
-	glEnable(GL_CULL_FACE);
-	glFrontFace(GL_CCW);
-	glEnable(GL_DEPTH_TEST);
+	gl_viewport(this->pos.x,
+	            framebuffer_height - this->pos.y - this->size.y,
+	            this->size.x,
+	            this->size.y);
+	gl_enable(GL_CULL_FACE);
+	gl_front_face(GL_CCW);
+	gl_enable(GL_DEPTH_TEST);
 
 	const camera_t& cam = this->camera;
 	const mat4 transform = cam.get_proj() * cam.get_view();
+	gl_camera_upload(cam, this->size);
 
-	glUseProgram(mesh_program);
-	glUniformMatrix4fv(0, 1, GL_FALSE, glm::value_ptr(transform));
+	/* mesh.vert takes the camera from its block, and this as the model */
+	imm::use_program(glsl_program(mesh_program));
+	imm::set_transform(mat4(1.0));
 
 	imm::begin(GL_QUADS);
 	imm::vertex({ -1, -1, 0 });
@@ -94,6 +140,13 @@ void viewport3d_t::render () const
 	imm::vertex({ 1, 1, 0 });
 	imm::vertex({ -1, 1, 0 });
 	imm::end();
+
+	/* Meshes have no color of their own */
+	glVertexAttrib3f(imm::attrib_loc::COLOR, 0.8, 0.8, 0.8);
+	scene_draw(transform);
+
+	/* Whatever imm:: batches there are, before the viewport changes */
+	imm::flush();
 }
 
 void viewport3d_t::set_dimension (vec2 p, vec2 s)
@@ -9,7 +9,8 @@ void app_deinit ();
 void app_update ();
 
 struct viewport3d_t {
-	void render () const;
+	/* Into the default framebuffer, of that height */
+	void render (int framebuffer_height) const;
 	void set_dimension (vec2 pos_top_left, vec2 size);
 
 	camera_t camera;
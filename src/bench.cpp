@@ -0,0 +1,55 @@
+#include "bench.h"
+#include "cull.h"
+#include "gl_immediate.h"
+#include "job.h"
+#include "obj.h"
+#include "occlusion.h"
+#include "scene.h"
+#include "util.h"
+#include <cstdio>
+#include <cstring>
+
+const char* app_benchmark = nullptr;
+int app_benchmark_size = 0;
+
+struct benchmark_t {
+	const char* name;
+	bool needs_gl;
+	int default_size;
+	void (*run) (int size);
+};
+
+const static benchmark_t benchmarks[] = {
+	{ "obj-load", false, 16, obj_load_benchmark },
+	{ "imm", true, 100, imm::benchmark },
+	{ "scene", true, 50'000, scene_benchmark },
+	{ "cull", false, 1'000'000, cull_benchmark },
+	{ "occlusion", false, 100'000, occlusion_benchmark },
+	{ "jobs", false, 1'000'000, job_benchmark },
+};
+
+constexpr int benchmark_nr = sizeof(benchmarks) / sizeof(benchmark_t);
+
+static const benchmark_t& find_benchmark (const char* name)
+{
+	for (const benchmark_t& b: benchmarks) {
+		if (strcmp(b.name, name) == 0)
+			return b;
+	}
+
+	fprintf(stderr, "Available benchmarks:\n");
+	for (const benchmark_t& b: benchmarks)
+		fprintf(stderr, "  %s\n", b.name);
+	fatal("No benchmark named \"%s\"", name);
+}
+
+bool benchmark_needs_gl (const char* name)
+{
+	return find_benchmark(name).needs_gl;
+}
+
+void benchmark_run (const char* name, int size)
+{
+	const benchmark_t& b = find_benchmark(name);
+	b.run(size > 0 ? size : b.default_size);
+}
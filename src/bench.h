@@ -0,0 +1,16 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/*
+ * With --benchmark=<name>, the named benchmark is run instead of the app.
+ * --benchmark-size=<N> scales whatever the benchmark iterates over;
+ * what exactly N means is up to the benchmark, 0 picks its default
+ */
+extern const char* app_benchmark;
+extern int app_benchmark_size;
+
+/* Whether the benchmark has to run after the window and GL context are up */
+bool benchmark_needs_gl (const char* name);
+void benchmark_run (const char* name, int size);
+
+#endif /* BENCH_H */
@@ -0,0 +1,260 @@
+#include "cull.h"
+#include "util.h"
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CULL_X86
+#include <immintrin.h>
+#endif
+
+void cull_boxes_t::resize (uint32_t n)
+{
+	const uint32_t padded = (n + 7) & ~7u;
+	for (std::vector<float>* v: { &min_x, &min_y, &min_z, &max_x, &max_y, &max_z })
+		v->resize(padded, 0.0f);
+	count = n;
+}
+
+void cull_boxes_t::set (uint32_t i, const aabb_t& box)
+{
+	min_x[i] = box.min.x;
+	min_y[i] = box.min.y;
+	min_z[i] = box.min.z;
+	max_x[i] = box.max.x;
+	max_y[i] = box.max.y;
+	max_z[i] = box.max.z;
+}
+
+void cull_boxes_t::push_back (const aabb_t& box)
+{
+	resize(count + 1);
+	set(count - 1, box);
+}
+
+frustum_t frustum_from_matrix (const mat4& m)
+{
+	/* Gribb and Hartmann: -w <= x, y, z <= w, with rows of the matrix */
+	vec4 row[4];
+	for (int i = 0; i < 4; i++)
+		row[i] = vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+
+	frustum_t f;
+	for (int axis = 0; axis < 3; axis++) {
+		f.planes[2 * axis + 0] = row[3] + row[axis];
+		f.planes[2 * axis + 1] = row[3] - row[axis];
+	}
+	/* Only the sign of the distance matters, so no need to normalize */
+	return f;
+}
+
+/*
+ * A plane, with the corner of a box furthest along its normal picked
+ * once for all boxes: the box is outside if that corner is
+ */
+struct plane_corner_t {
+	float a, b, c, d;
+	const float* x;
+	const float* y;
+	const float* z;
+};
+
+static void plane_corners (const frustum_t& frustum, const cull_boxes_t& boxes,
+		plane_corner_t corners[6])
+{
+	for (int p = 0; p < 6; p++) {
+		const vec4& pl = frustum.planes[p];
+		corners[p] = { pl.x, pl.y, pl.z, pl.w,
+		               (pl.x >= 0.0f ? boxes.max_x : boxes.min_x).data(),
+		               (pl.y >= 0.0f ? boxes.max_y : boxes.min_y).data(),
+		               (pl.z >= 0.0f ? boxes.max_z : boxes.min_z).data() };
+	}
+}
+
+/* Writes the indices of the lanes set in `mask` without branching */
+static inline uint32_t emit_visible (uint32_t* out, uint32_t first, uint32_t mask, int lanes)
+{
+	uint32_t n = 0;
+	for (int j = 0; j < lanes; j++) {
+		out[n] = first + j;
+		n += (mask >> j) & 1;
+	}
+	return n;
+}
+
+static uint32_t cull_scalar (const plane_corner_t corners[6], uint32_t count, uint32_t* out)
+{
+	uint32_t n = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		bool inside = true;
+		for (int p = 0; p < 6; p++) {
+			const plane_corner_t& c = corners[p];
+			inside &= c.a * c.x[i] + c.b * c.y[i] + c.c * c.z[i] + c.d >= 0.0f;
+		}
+		out[n] = i;
+		n += inside;
+	}
+	return n;
+}
+
+#ifdef CULL_X86
+
+static uint32_t cull_sse (const plane_corner_t corners[6], uint32_t count, uint32_t* out)
+{
+	const __m128 zero = _mm_setzero_ps();
+	uint32_t n = 0;
+	for (uint32_t i = 0; i < count; i += 4) {
+		__m128 inside = _mm_cmpeq_ps(zero, zero);
+		for (int p = 0; p < 6; p++) {
+			const plane_corner_t& c = corners[p];
+			__m128 dist = _mm_mul_ps(_mm_set1_ps(c.a), _mm_loadu_ps(c.x + i));
+			dist = _mm_add_ps(dist, _mm_mul_ps(_mm_set1_ps(c.b), _mm_loadu_ps(c.y + i)));
+			dist = _mm_add_ps(dist, _mm_mul_ps(_mm_set1_ps(c.c), _mm_loadu_ps(c.z + i)));
+			dist = _mm_add_ps(dist, _mm_set1_ps(c.d));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(dist, zero));
+		}
+		const int lanes = std::min(count - i, 4u);
+		const uint32_t mask = _mm_movemask_ps(inside) & ((1u << lanes) - 1);
+		n += emit_visible(out + n, i, mask, 4);
+	}
+	return n;
+}
+
+/*
+ * Without FMA, and in the same order as the others, so that all of them
+ * agree to the bit on boxes right on a plane
+ */
+__attribute__((target("avx2")))
+static uint32_t cull_avx2 (const plane_corner_t corners[6], uint32_t count, uint32_t* out)
+{
+	/* The planes stay in registers across the loop */
+	__m256 a[6], b[6], c[6], d[6];
+	for (int p = 0; p < 6; p++) {
+		a[p] = _mm256_set1_ps(corners[p].a);
+		b[p] = _mm256_set1_ps(corners[p].b);
+		c[p] = _mm256_set1_ps(corners[p].c);
+		d[p] = _mm256_set1_ps(corners[p].d);
+	}
+
+	uint32_t n = 0;
+	for (uint32_t i = 0; i < count; i += 8) {
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (int p = 0; p < 6; p++) {
+			__m256 dist = _mm256_mul_ps(a[p], _mm256_loadu_ps(corners[p].x + i));
+			dist = _mm256_add_ps(dist, _mm256_mul_ps(b[p], _mm256_loadu_ps(corners[p].y + i)));
+			dist = _mm256_add_ps(dist, _mm256_mul_ps(c[p], _mm256_loadu_ps(corners[p].z + i)));
+			dist = _mm256_add_ps(dist, d[p]);
+			inside = _mm256_and_ps(inside,
+					_mm256_cmp_ps(dist, _mm256_setzero_ps(), _CMP_GE_OQ));
+		}
+		const int lanes = std::min(count - i, 8u);
+		const uint32_t mask = _mm256_movemask_ps(inside) & ((1u << lanes) - 1);
+		n += emit_visible(out + n, i, mask, 8);
+	}
+	return n;
+}
+
+#endif /* CULL_X86 */
+
+bool cull_impl_supported (cull_impl_t impl)
+{
+	switch (impl) {
+	case CULL_SCALAR:
+		return true;
+#ifdef CULL_X86
+	case CULL_SSE:
+		return __builtin_cpu_supports("sse");
+	case CULL_AVX2:
+		return __builtin_cpu_supports("avx2");
+#endif
+	default:
+		return false;
+	}
+}
+
+static cull_impl_t find_best_impl ()
+{
+	for (cull_impl_t impl: { CULL_AVX2, CULL_SSE }) {
+		if (cull_impl_supported(impl))
+			return impl;
+	}
+	return CULL_SCALAR;
+}
+
+const cull_impl_t cull_best_impl = find_best_impl();
+
+void cull_frustum (const frustum_t& frustum, const cull_boxes_t& boxes,
+		std::vector<uint32_t>& visible, cull_impl_t impl)
+{
+	plane_corner_t corners[6];
+	plane_corners(frustum, boxes, corners);
+
+	/* Room for every box, plus what a full lane group writes past the end */
+	visible.resize(boxes.count + 8);
+	uint32_t n;
+	switch (impl) {
+#ifdef CULL_X86
+	case CULL_SSE:
+		n = cull_sse(corners, boxes.count, visible.data());
+		break;
+	case CULL_AVX2:
+		n = cull_avx2(corners, boxes.count, visible.data());
+		break;
+#endif
+	default:
+		n = cull_scalar(corners, boxes.count, visible.data());
+		break;
+	}
+	visible.resize(n);
+}
+
+/* ================ BENCHMARK ================ */
+
+void cull_benchmark (int num_boxes)
+{
+	constexpr int NUM_RUNS = 50;
+
+	/* Boxes of up to 4 units strewn in a 1000 unit cube around the camera */
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> pos(-500.0f, 500.0f);
+	std::uniform_real_distribution<float> size(0.1f, 4.0f);
+	cull_boxes_t boxes;
+	for (int i = 0; i < num_boxes; i++) {
+		const vec3 min(pos(rng), pos(rng), pos(rng));
+		boxes.push_back({ min, min + vec3(size(rng), size(rng), size(rng)) });
+	}
+
+	const mat4 view_proj = glm::perspective(glm::radians(70.0f), 16.0f / 9.0f, 0.1f, 300.0f)
+		* glm::lookAt(vec3(0.0f), vec3(1, 0.3, 0.2), vec3(0, 0, 1));
+	const frustum_t frustum = frustum_from_matrix(view_proj);
+
+	std::vector<uint32_t> reference;
+	cull_frustum(frustum, boxes, reference, CULL_SCALAR);
+	printf("cull: %i boxes, %zu visible\n", num_boxes, reference.size());
+
+	const struct { cull_impl_t impl; const char* name; } impls[] = {
+		{ CULL_SCALAR, "scalar" },
+		{ CULL_SSE, "SSE" },
+		{ CULL_AVX2, "AVX2" },
+	};
+	for (const auto& im: impls) {
+		if (!cull_impl_supported(im.impl)) {
+			printf("  %-8s not supported\n", im.name);
+			continue;
+		}
+
+		std::vector<uint32_t> visible;
+		double best = 1e9;
+		for (int run = 0; run < NUM_RUNS; run++) {
+			const double t_start = time_seconds();
+			cull_frustum(frustum, boxes, visible, im.impl);
+			best = std::min(best, time_seconds() - t_start);
+		}
+		if (visible != reference)
+			fatal("Culling with %s differs from the scalar one", im.name);
+
+		printf("  %-8s %8.3f ms, %7.1f M boxes/s\n",
+				im.name, best * 1e3, num_boxes / best * 1e-6);
+	}
+}
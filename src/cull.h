@@ -0,0 +1,51 @@
+#ifndef CULL_H
+#define CULL_H
+
+#include "math.h"
+#include <cstdint>
+#include <vector>
+
+/*
+ * Bounding boxes as structure of arrays, so that they can be tested
+ * 4 or 8 at a time. The arrays are padded to a multiple of 8
+ */
+struct cull_boxes_t {
+	std::vector<float> min_x, min_y, min_z;
+	std::vector<float> max_x, max_y, max_z;
+	uint32_t count = 0;
+
+	void resize (uint32_t n);
+	void set (uint32_t i, const aabb_t& box);
+	void push_back (const aabb_t& box);
+	void clear () { resize(0); }
+};
+
+/* Planes as (normal, d), with the inside where dot(normal, p) + d >= 0 */
+struct frustum_t {
+	vec4 planes[6];
+};
+
+/* Of the clip space of view_proj, with GL's -1..1 depth */
+frustum_t frustum_from_matrix (const mat4& view_proj);
+
+enum cull_impl_t {
+	CULL_SCALAR,
+	CULL_SSE,
+	CULL_AVX2,
+};
+/* The fastest one the CPU can run */
+extern const cull_impl_t cull_best_impl;
+bool cull_impl_supported (cull_impl_t impl);
+
+/*
+ * Replaces `visible` with the indices, in order, of the boxes at least
+ * partly inside the frustum. Boxes that merely cross the corner of two
+ * planes outside of it may be kept
+ */
+void cull_frustum (const frustum_t& frustum, const cull_boxes_t& boxes,
+		std::vector<uint32_t>& visible, cull_impl_t impl = cull_best_impl);
+
+/* --benchmark=cull: that many boxes, culled with each implementation */
+void cull_benchmark (int num_boxes);
+
+#endif /* CULL_H */
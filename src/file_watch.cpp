@@ -0,0 +1,113 @@
+#include "file_watch.h"
+#include "util.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#ifdef LINUX
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+static std::thread watch_thread;
+static std::mutex changes_mutex;
+static std::vector<std::string> changes;
+static std::atomic<bool> has_changes;
+
+#ifdef LINUX
+
+static int inotify_fd = -1;
+/* Written to wake the thread up when it's time to stop */
+static int stop_fd = -1;
+
+static void watch_loop ()
+{
+	/* Enough for a few events at a time, aligned as inotify wants */
+	alignas(inotify_event) char buf[16 * (sizeof(inotify_event) + 256)];
+	pollfd fds[2] = { { inotify_fd, POLLIN, 0 }, { stop_fd, POLLIN, 0 } };
+
+	while (true) {
+		if (poll(fds, 2, -1) < 0)
+			continue;
+		if (fds[1].revents != 0)
+			return;
+
+		const ssize_t len = read(inotify_fd, buf, sizeof(buf));
+		if (len <= 0)
+			continue;
+
+		std::lock_guard<std::mutex> lock(changes_mutex);
+		for (ssize_t i = 0; i < len; ) {
+			const inotify_event* e = (const inotify_event*) (buf + i);
+			i += sizeof(inotify_event) + e->len;
+			if (e->len == 0)
+				continue;
+			/* Editors tend to write a file in a few goes */
+			const std::string name = e->name;
+			if (std::find(changes.begin(), changes.end(), name) == changes.end())
+				changes.push_back(name);
+		}
+		has_changes = !changes.empty();
+	}
+}
+
+bool file_watch_start (const std::string& dir)
+{
+	inotify_fd = inotify_init1(IN_CLOEXEC);
+	if (inotify_fd < 0) {
+		warning("Cannot watch %s: inotify_init1 failed", dir.c_str());
+		return false;
+	}
+	/* Written in place, or replaced by a rename as most editors save */
+	if (inotify_add_watch(inotify_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		warning("Cannot watch %s", dir.c_str());
+		close(inotify_fd);
+		inotify_fd = -1;
+		return false;
+	}
+	stop_fd = eventfd(0, EFD_CLOEXEC);
+	watch_thread = std::thread(watch_loop);
+	return true;
+}
+
+void file_watch_stop ()
+{
+	if (!watch_thread.joinable())
+		return;
+	const uint64_t one = 1;
+	if (write(stop_fd, &one, sizeof(one)) != sizeof(one))
+		warning("Cannot stop watching files");
+	watch_thread.join();
+	close(stop_fd);
+	close(inotify_fd);
+	stop_fd = inotify_fd = -1;
+}
+
+#else
+
+bool file_watch_start (const std::string& dir)
+{
+	info("Not watching %s, there's no inotify", dir.c_str());
+	return false;
+}
+
+void file_watch_stop ()
+{
+}
+
+#endif /* LINUX */
+
+bool file_watch_changes (std::vector<std::string>& names)
+{
+	if (!has_changes.load(std::memory_order_relaxed))
+		return false;
+
+	std::lock_guard<std::mutex> lock(changes_mutex);
+	names.insert(names.end(), changes.begin(), changes.end());
+	changes.clear();
+	has_changes = false;
+	return true;
+}
@@ -0,0 +1,19 @@
+#ifndef FILE_WATCH_H
+#define FILE_WATCH_H
+
+#include <string>
+#include <vector>
+
+/*
+ * Notices files of a directory being written or replaced, on a thread of
+ * its own that sleeps in the kernel until one is. Asking for the changes
+ * is an atomic load when there are none, so it can be done every frame.
+ * Only on Linux, with inotify; elsewhere nothing ever changes
+ */
+bool file_watch_start (const std::string& dir);
+void file_watch_stop ();
+
+/* Appends the names, within the directory, of those changed since the last call */
+bool file_watch_changes (std::vector<std::string>& names);
+
+#endif /* FILE_WATCH_H */
@@ -1,14 +1,18 @@
-#include "app.h"
 #include "gl.h"
+#include "gl_camera.h"
 #include "gl_immediate.h"
 #include "gl_glsl.h"
+#include "gl_upload.h"
 #include "util.h"
-#include "gui.h"
 #include <array>
+#include <mutex>
 #include <vector>
 
 bool app_opengl_debug = false;
 int app_opengl_msaa = -1;
+bool app_multi_draw_indirect = true;
+bool app_shader_hot_reload = true;
+bool app_shaders_from_disk = false;
 render_context_t render_context;
 
 void render_init ()
@@ -36,14 +40,22 @@ void render_init ()
 	if (render_context.sdl_gl_context == nullptr)
 		fatal("SDL GL context creation failed: %s", SDL_GetError());
 
+	/* Creating it makes it current, so the main one is made current again */
+	SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+	render_context.sdl_worker_gl_context = SDL_GL_CreateContext(render_context.sdl_window);
+	if (render_context.sdl_worker_gl_context == nullptr)
+		warning("No worker GL context: %s", SDL_GetError());
+	SDL_GL_MakeCurrent(render_context.sdl_window, render_context.sdl_gl_context);
+
 	glewExperimental = true;
 	if (glewInit() != GLEW_OK)
 		fatal("GLEW init failed");
+	gl_state_invalidate();
 
 	SDL_GL_SetSwapInterval(-1);
 
 	if (app_opengl_msaa > 0) {
-		glEnable(GL_MULTISAMPLE);
+		gl_enable(GL_MULTISAMPLE);
 		SDL_GL_SetAttribute(SDL_GL_MULTISAMPLEBUFFERS, 1);
 		SDL_GL_SetAttribute(SDL_GL_MULTISAMPLESAMPLES, app_opengl_msaa);
 	}
@@ -60,7 +72,22 @@ void render_init ()
 		glDebugMessageCallback(msg_callback, nullptr);
 	}
 
+	/* Its shader is GLSL 4.30, so the extensions alone won't do */
+	render_context.has_multi_draw_indirect = app_multi_draw_indirect
+		&& GLEW_VERSION_4_3
+		&& GLEW_ARB_shader_draw_parameters;
+	info("OpenGL %s (%s), %s", glGetString(GL_VERSION), glGetString(GL_RENDERER),
+			render_context.has_multi_draw_indirect ? "multi-draw indirect"
+			                                       : "a draw per object");
+
+	glsl_init();
+	if (!app_shaders_from_disk)
+		glsl_use_embedded_shaders();
+	else if (app_shader_hot_reload)
+		glsl_hot_reload_start();
 	imm::init();
+	gl_camera_init();
+	gl_upload_init();
 
 	render_context.is_initialized = true;
 }
@@ -69,30 +96,37 @@ void render_deinit ()
 {
 	render_context.is_initialized = false;
 
+	gl_upload_deinit();
+	gl_camera_deinit();
 	imm::deinit();
+	glsl_deinit();
 
+	if (render_context.sdl_worker_gl_context != nullptr)
+		SDL_GL_DeleteContext(render_context.sdl_worker_gl_context);
 	SDL_GL_DeleteContext(render_context.sdl_gl_context);
 	SDL_DestroyWindow(render_context.sdl_window);
 	SDL_Quit();
 }
 
-void render_frame ()
-{
-	glViewport(0, 0, render_context.resolution_x, render_context.resolution_y);
-	glClearColor(0.0, 0.0, 0.0, 1.0);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	render_context.is_rendering = true;
-
-	viewport.set_dimension(gui_viewport3d_pos, gui_viewport3d_size);
-	viewport.render();
-
-	gui_render_frame();
+static std::mutex worker_context_mutex;
 
-	SDL_GL_SwapWindow(render_context.sdl_window);
-	render_context.is_rendering = false;
+bool render_worker_context_begin ()
+{
+	if (render_context.sdl_worker_gl_context == nullptr)
+		return false;
+	worker_context_mutex.lock();
+	if (SDL_GL_MakeCurrent(render_context.sdl_window, render_context.sdl_worker_gl_context) != 0) {
+		warning("Cannot make the worker GL context current: %s", SDL_GetError());
+		worker_context_mutex.unlock();
+		return false;
+	}
+	return true;
+}
 
-	if (GLenum err = glGetError(); err != 0)
-		warning("OpenGL error: %i (0x%x)", err, err);
+void render_worker_context_end ()
+{
+	SDL_GL_MakeCurrent(render_context.sdl_window, nullptr);
+	worker_context_mutex.unlock();
 }
 
 void render_resize_window (int w, int h)
@@ -110,7 +144,8 @@ void gl_vertex_attrib_ptr (
 		size_t start_pointer)
 {
 	glEnableVertexAttribArray(attrib_location);
-	switch (data_type) {
+	/* Normalized integers are read as floats */
+	switch (should_normalize ? GL_FLOAT : data_type) {
 	case GL_BYTE:
 	case GL_UNSIGNED_BYTE:
 	case GL_SHORT:
@@ -140,8 +175,12 @@ GLuint gl_gen_vertex_array ()
 	return r;
 }
 
+static void forget_vertex_array (GLuint vao);
+static void forget_buffer (GLuint buffer);
+
 void gl_delete_vertex_array (GLuint& a)
 {
+	forget_vertex_array(a);
 	glDeleteVertexArrays(1, &a);
 	a = 0;
 }
@@ -157,6 +196,217 @@ GLuint gl_gen_buffer ()
 
 void gl_delete_buffer (GLuint& b)
 {
+	forget_buffer(b);
 	glDeleteBuffers(1, &b);
 	b = 0;
 }
+
+/* ================ STATE CACHE ================ */
+
+gl_state_counters_t gl_state_counters;
+gl_state_counters_t gl_state_counters_last_frame;
+
+/* Not a name GL hands out, so whatever is set next goes through */
+static constexpr GLuint UNKNOWN = ~0u;
+
+/* Anything else goes straight to GL */
+static constexpr GLenum CACHED_BUFFER_TARGETS[] = {
+	GL_ARRAY_BUFFER,
+	GL_ELEMENT_ARRAY_BUFFER,
+	GL_COPY_READ_BUFFER,
+	GL_COPY_WRITE_BUFFER,
+	GL_DRAW_INDIRECT_BUFFER,
+	GL_PIXEL_PACK_BUFFER,
+	GL_PIXEL_UNPACK_BUFFER,
+	GL_SHADER_STORAGE_BUFFER,
+	GL_TEXTURE_BUFFER,
+	GL_UNIFORM_BUFFER,
+};
+static constexpr GLenum CACHED_INDEXED_TARGETS[] = {
+	GL_SHADER_STORAGE_BUFFER,
+	GL_UNIFORM_BUFFER,
+};
+static constexpr GLuint CACHED_INDICES = 16;
+static constexpr GLenum CACHED_CAPS[] = {
+	GL_BLEND,
+	GL_CULL_FACE,
+	GL_DEPTH_TEST,
+	GL_MULTISAMPLE,
+	GL_PRIMITIVE_RESTART,
+	GL_SCISSOR_TEST,
+	GL_STENCIL_TEST,
+};
+
+constexpr int NUM_BUFFER_TARGETS = sizeof(CACHED_BUFFER_TARGETS) / sizeof(GLenum);
+constexpr int NUM_INDEXED_TARGETS = sizeof(CACHED_INDEXED_TARGETS) / sizeof(GLenum);
+constexpr int NUM_CAPS = sizeof(CACHED_CAPS) / sizeof(GLenum);
+
+/* What GL has, or UNKNOWN */
+static struct {
+	GLuint program;
+	GLuint vao;
+	GLuint buffers[NUM_BUFFER_TARGETS];
+	GLuint indexed_buffers[NUM_INDEXED_TARGETS][CACHED_INDICES];
+	GLuint enabled[NUM_CAPS];
+	std::array<GLenum, 2> blend_func;
+	GLuint depth_func;
+	GLuint depth_mask;
+	GLuint front_face;
+	GLuint cull_face;
+	std::array<int, 4> viewport;
+} state;
+
+template <int N>
+static int find_index (const GLenum (&list)[N], GLenum x)
+{
+	for (int i = 0; i < N; i++) {
+		if (list[i] == x)
+			return i;
+	}
+	return -1;
+}
+
+/* Counts the call and tells whether it's needed, remembering the new value */
+template <class T>
+static bool changes (T& cached, const T& value)
+{
+	if (cached == value) {
+		gl_state_counters.filtered++;
+		return false;
+	}
+	cached = value;
+	gl_state_counters.issued++;
+	return true;
+}
+
+static bool uncached ()
+{
+	gl_state_counters.issued++;
+	return true;
+}
+
+void gl_use_program (GLuint program)
+{
+	if (changes(state.program, program))
+		glUseProgram(program);
+}
+
+void gl_bind_vertex_array (GLuint vao)
+{
+	if (changes(state.vao, vao)) {
+		glBindVertexArray(vao);
+		state.buffers[find_index(CACHED_BUFFER_TARGETS, GL_ELEMENT_ARRAY_BUFFER)] = UNKNOWN;
+	}
+}
+
+void gl_bind_buffer (GLenum target, GLuint buffer)
+{
+	const int t = find_index(CACHED_BUFFER_TARGETS, target);
+	if (t >= 0 ? changes(state.buffers[t], buffer) : uncached())
+		glBindBuffer(target, buffer);
+}
+
+void gl_bind_buffer_base (GLenum target, GLuint index, GLuint buffer)
+{
+	const int t = find_index(CACHED_INDEXED_TARGETS, target);
+	if (t >= 0 && index < CACHED_INDICES ? changes(state.indexed_buffers[t][index], buffer)
+	                                     : uncached())
+		glBindBufferBase(target, index, buffer);
+
+	if (const int g = find_index(CACHED_BUFFER_TARGETS, target); g >= 0)
+		state.buffers[g] = buffer;
+}
+
+void gl_set_enabled (GLenum cap, bool enabled)
+{
+	const int c = find_index(CACHED_CAPS, cap);
+	if (c >= 0 ? changes(state.enabled[c], (GLuint) enabled) : uncached()) {
+		if (enabled)
+			glEnable(cap);
+		else
+			glDisable(cap);
+	}
+}
+
+void gl_blend_func (GLenum src, GLenum dst)
+{
+	if (changes(state.blend_func, { src, dst }))
+		glBlendFunc(src, dst);
+}
+
+void gl_depth_func (GLenum func)
+{
+	if (changes(state.depth_func, func))
+		glDepthFunc(func);
+}
+
+void gl_depth_mask (bool write)
+{
+	if (changes(state.depth_mask, (GLuint) write))
+		glDepthMask(write);
+}
+
+void gl_front_face (GLenum mode)
+{
+	if (changes(state.front_face, mode))
+		glFrontFace(mode);
+}
+
+void gl_cull_face (GLenum mode)
+{
+	if (changes(state.cull_face, mode))
+		glCullFace(mode);
+}
+
+void gl_viewport (int x, int y, int w, int h)
+{
+	if (changes(state.viewport, { x, y, w, h }))
+		glViewport(x, y, w, h);
+}
+
+void gl_state_forget_program (GLuint program)
+{
+	if (state.program == program)
+		state.program = UNKNOWN;
+}
+
+/* Deleting them unbinds them from the context */
+static void forget_vertex_array (GLuint vao)
+{
+	if (state.vao == vao)
+		state.vao = 0;
+}
+
+static void forget_buffer (GLuint buffer)
+{
+	for (GLuint& b: state.buffers) {
+		if (b == buffer)
+			b = 0;
+	}
+	for (auto& target: state.indexed_buffers) {
+		for (GLuint& b: target) {
+			if (b == buffer)
+				b = 0;
+		}
+	}
+}
+
+void gl_state_invalidate ()
+{
+	state.program = UNKNOWN;
+	state.vao = UNKNOWN;
+	for (GLuint& b: state.buffers)
+		b = UNKNOWN;
+	for (auto& target: state.indexed_buffers) {
+		for (GLuint& b: target)
+			b = UNKNOWN;
+	}
+	for (GLuint& e: state.enabled)
+		e = UNKNOWN;
+	state.blend_func = { UNKNOWN, UNKNOWN };
+	state.depth_func = UNKNOWN;
+	state.depth_mask = UNKNOWN;
+	state.front_face = UNKNOWN;
+	state.cull_face = UNKNOWN;
+	state.viewport = { -1, -1, -1, -1 };
+}
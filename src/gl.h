@@ -14,9 +14,17 @@ struct render_context_t {
 				| SDL_WINDOW_RESIZABLE;
 	SDL_Window* sdl_window;
 	SDL_GLContext sdl_gl_context;
+	/* Shares objects with sdl_gl_context, for other threads */
+	SDL_GLContext sdl_worker_gl_context;
 
 	bool is_initialized = false;
 	bool is_rendering;
+
+	/*
+	 * The context is made for 3.3, but drivers give what they have.
+	 * Multi-draw indirect with SSBOs and gl_DrawID is 4.3 and up
+	 */
+	bool has_multi_draw_indirect;
 };
 extern render_context_t render_context;
 
@@ -29,26 +37,45 @@ namespace gl_constants
 	constexpr const char* PATH_SHADER = "shader/";
 
 	/*
-	 * Whether to put #line 5 "my_shader.frag" instead of just #line 5.
+	 * Whether to put #line 5 "my_shader.frag" instead of #line 5 2, with
+	 * the files listed by number in the compile error.
 	 * This isn't in the spec; nvidia seems to support it, AMD is less happy
+	 * and Mesa refuses it without ARB_shading_language_include
 	 */
-	constexpr bool GLSL_FILENAME_IN_LINE_DIRECTIVE = true;
+	constexpr bool GLSL_FILENAME_IN_LINE_DIRECTIVE = false;
 }
 
 extern bool app_opengl_debug;
 extern int app_opengl_msaa;
+/* Off with --no-multi-draw-indirect, to use the 3.3 path regardless */
+extern bool app_multi_draw_indirect;
+/*
+ * Shaders are built into the binary, unless --shaders-from-disk. Then
+ * they're reloaded when they change, unless --no-shader-hot-reload
+ */
+extern bool app_shaders_from_disk;
+extern bool app_shader_hot_reload;
 
 void render_init ();
 void render_deinit ();
 
-void render_frame ();
 void render_resize_window (int w, int h);
 
+/*
+ * Makes the worker context current on the calling thread, which isn't
+ * the main one, waiting for any other thread that has it. False if there
+ * is no worker context. Objects made on it are only safe to use on the
+ * main context once it's done with them: after glFinish, or a fence
+ */
+bool render_worker_context_begin ();
+void render_worker_context_end ();
+
 /* Thin wrappers aronund GL functions, where appropriate */
 
 /*
  *  Also does EnableVertexAttribArray so that you don't forget to
- *  and takes care of the stupid (void*) cast of the start pointer
+ *  and takes care of the stupid (void*) cast of the start pointer.
+ *  Integer types stay integers in the shader unless normalized
  */
 void gl_vertex_attrib_ptr (
 		int attrib_location,
@@ -64,4 +91,42 @@ void gl_delete_vertex_array (GLuint&);
 GLuint gl_gen_buffer ();
 void gl_delete_buffer (GLuint&);
 
+/*
+ * Render state cache. The state set through these is remembered, and
+ * setting it to what it already is doesn't reach GL. This only holds as
+ * long as all of it is set through here (on the main context), so code
+ * that doesn't, like ImGui's backend, has to be followed by
+ * gl_state_invalidate().
+ *
+ * The element array buffer binding is part of the VAO, so binding a VAO
+ * forgets it
+ */
+void gl_use_program (GLuint program);
+void gl_bind_vertex_array (GLuint vao);
+void gl_bind_buffer (GLenum target, GLuint buffer);
+/* Also binds the generic binding point, as GL does */
+void gl_bind_buffer_base (GLenum target, GLuint index, GLuint buffer);
+void gl_set_enabled (GLenum cap, bool enabled);
+inline void gl_enable (GLenum cap) { gl_set_enabled(cap, true); }
+inline void gl_disable (GLenum cap) { gl_set_enabled(cap, false); }
+void gl_blend_func (GLenum src, GLenum dst);
+void gl_depth_func (GLenum func);
+void gl_depth_mask (bool write);
+void gl_front_face (GLenum mode);
+void gl_cull_face (GLenum mode);
+void gl_viewport (int x, int y, int w, int h);
+
+/* Before glDeleteProgram, as the name may come back for another program */
+void gl_state_forget_program (GLuint program);
+void gl_state_invalidate ();
+
+struct gl_state_counters_t {
+	/* Calls that reached GL, and those that were skipped */
+	uint32_t issued;
+	uint32_t filtered;
+};
+/* Of the frame being rendered, and of the one before */
+extern gl_state_counters_t gl_state_counters;
+extern gl_state_counters_t gl_state_counters_last_frame;
+
 #endif /* GL_H */
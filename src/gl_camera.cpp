@@ -0,0 +1,47 @@
+#include "gl_camera.h"
+#include "gl_glsl.h"
+#include "util.h"
+
+static GLuint camera_ubo;
+static double start_time;
+
+void gl_camera_init ()
+{
+	camera_ubo = gl_gen_buffer();
+	gl_bind_buffer(GL_UNIFORM_BUFFER, camera_ubo);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(gl_camera_block_t), nullptr, GL_STREAM_DRAW);
+	start_time = time_seconds();
+}
+
+void gl_camera_deinit ()
+{
+	gl_delete_buffer(camera_ubo);
+}
+
+void gl_camera_upload (const mat4& view, const mat4& proj, vec2 viewport_size)
+{
+	gl_camera_block_t b;
+	b.view = view;
+	b.proj = proj;
+	b.view_proj = proj * view;
+	b.inv_view = glm::inverse(view);
+	b.inv_proj = glm::inverse(proj);
+	b.inv_view_proj = glm::inverse(b.view_proj);
+	b.pos = b.inv_view[3];
+	b.viewport_size = viewport_size;
+	b.time = time_seconds() - start_time;
+	b.padding = 0.0f;
+
+	/*
+	 * Orphaned each time, so that the draws into the last viewport
+	 * don't hold up the next one
+	 */
+	gl_bind_buffer(GL_UNIFORM_BUFFER, camera_ubo);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(b), &b, GL_STREAM_DRAW);
+	gl_bind_buffer_base(GL_UNIFORM_BUFFER, GLSL_BINDING_CAMERA, camera_ubo);
+}
+
+void gl_camera_upload (const camera_t& camera, vec2 viewport_size)
+{
+	gl_camera_upload(camera.get_view(), camera.get_proj(), viewport_size);
+}
@@ -0,0 +1,34 @@
+#ifndef GL_CAMERA_H
+#define GL_CAMERA_H
+
+#include "camera.h"
+#include "gl.h"
+#include "math.h"
+
+/* As camera_block in shader/camera.glsl, std140 */
+struct gl_camera_block_t {
+	mat4 view;
+	mat4 proj;
+	mat4 view_proj;
+	mat4 inv_view;
+	mat4 inv_proj;
+	mat4 inv_view_proj;
+	vec4 pos;
+	vec2 viewport_size;
+	float time;
+	float padding;
+};
+static_assert(sizeof(gl_camera_block_t) == 6 * 64 + 32);
+
+/*
+ * One uniform buffer, at GLSL_BINDING_CAMERA, that every program with
+ * the block reads. Set up with the renderer
+ */
+void gl_camera_init ();
+void gl_camera_deinit ();
+
+/* Before drawing into each viewport */
+void gl_camera_upload (const mat4& view, const mat4& proj, vec2 viewport_size);
+void gl_camera_upload (const camera_t& camera, vec2 viewport_size);
+
+#endif /* GL_CAMERA_H */
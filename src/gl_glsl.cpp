@@ -1,17 +1,36 @@
 #include "gl_glsl.h"
+#include "file_watch.h"
+#include "glsl_source.h"
+#include "mapped_file.h"
 #include "util.h"
 #include <cassert>
-#include <fstream>
-#include <sstream>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
-static const char* GLSL_PROLOGUE =
+const char* const GLSL_PROLOGUE_330 =
 	"#version 330 core\n"
 	"#extension GL_ARB_explicit_uniform_location: require\n";
+const char* const GLSL_PROLOGUE_430 =
+	"#version 430 core\n"
+	"#extension GL_ARB_shader_draw_parameters: require\n";
 
-static GLuint glsl_load_shader_low (
-		GLenum shader_type, 
+/* The defines go in the same source string, to keep the numbers of the others */
+static std::string glsl_prologue (const char* prologue, const glsl_defines_t& defines)
+{
+	std::string s = prologue;
+	for (const std::string& d: defines)
+		s += "#define " + d + "\n";
+	return s;
+}
+
+static GLuint glsl_submit_shader (
+		GLenum shader_type,
 		const char* src,
-		const char* reported_file_path)
+		const char* reported_file_path,
+		const char* prologue)
 {
 	assert(shader_type == GL_FRAGMENT_SHADER
 	    || shader_type == GL_VERTEX_SHADER
@@ -22,15 +41,23 @@ static GLuint glsl_load_shader_low (
 		fatal("Shader %s: failed to create a new shader", reported_file_path);
 
 	constexpr int NUM_LINES = 2;
-	const char* lines[NUM_LINES] = { GLSL_PROLOGUE, src };
+	const char* lines[NUM_LINES] = { prologue, src };
 	glShaderSource(id, NUM_LINES, lines, nullptr);
 	glCompileShader(id);
+	return id;
+}
 
+/*
+ * Waits for the compile to finish, if the driver does it in the background.
+ * Empty if it went well
+ */
+static std::string glsl_shader_error (GLuint id, const char* reported_file_path)
+{
 	int success = 0;
 	glGetShaderiv(id, GL_COMPILE_STATUS, &success);
 
 	if (success)
-		return id;
+		return "";
 
 	int log_length = 0;
 	glGetShaderiv(id, GL_INFO_LOG_LENGTH, &log_length);
@@ -38,75 +65,45 @@ static GLuint glsl_load_shader_low (
 	log[log_length] = '\0';
 	glGetShaderInfoLog(id, log_length, &log_length, log);
 
-	fatal("Shader %s failed to compile. Log:\n%s", reported_file_path, log);
+	return std::string("Shader ") + reported_file_path + " failed to compile. Log:\n" + log;
 }
 
-GLuint glsl_load_shader_string (GLenum shader_type, const char* src)
+static void glsl_check_shader (GLuint id, const char* reported_file_path)
 {
-	return glsl_load_shader_low(shader_type, src, "<source string>");
+	const std::string error = glsl_shader_error(id, reported_file_path);
+	if (!error.empty())
+		fatal("%s", error.c_str());
 }
 
-static void glsl_line_directive (
-		std::ostringstream& src,
-		int line_nr,
-		const std::string& filename)
+static GLuint glsl_load_shader_low (
+		GLenum shader_type,
+		const char* src,
+		const char* reported_file_path,
+		const char* prologue)
 {
-	src << "#line " << line_nr;
-	if constexpr (gl_constants::GLSL_FILENAME_IN_LINE_DIRECTIVE)
-		src << " \"" << filename << '\"';
-	src << '\n';
+	GLuint id = glsl_submit_shader(shader_type, src, reported_file_path, prologue);
+	glsl_check_shader(id, reported_file_path);
+	return id;
 }
 
-static void glsl_append_source (
-		const std::string& original_path,
-		const std::string& path,
-		std::ostringstream& src,
-		int recursion_depth)
+GLuint glsl_load_shader_string (GLenum shader_type, const char* src)
 {
-	constexpr int max_recursion_depth = 100;
-	if (recursion_depth > max_recursion_depth) {
-		fatal("Shader %s has a recursive #include chain of depth > %i. "
-		      "Note that it is NOT possible to guard #include with "
-		      "conditional compilation directives!",
-		      original_path.c_str(), max_recursion_depth);
-	}
-
-	std::ifstream f(gl_constants::PATH_SHADER + path);
-	if (!f) {
-		if (recursion_depth == 0) {
-			fatal("Shader %s: cannot open file", path.c_str());
-		} else {
-			fatal("Shader %s (included from %s): cannot open file",
-					path.c_str(), original_path.c_str());
-		}
-	}
-
-	int line_nr = 1;
-	std::string line;
-	for (; std::getline(f, line); line_nr++) {
-		if (line.rfind("#include ", 0) == 0) {
-			std::string incl_path = line.substr(9, -1);
-			glsl_line_directive(src, 0, incl_path);
-			glsl_append_source(original_path, incl_path,
-					src, recursion_depth + 1);
-			glsl_line_directive(src, line_nr + 1, path);
-		} else {
-			src << line << '\n';
-		}
-	}
+	return glsl_load_shader_low(shader_type, src, "<source string>", GLSL_PROLOGUE_330);
 }
 
-GLuint glsl_load_shader_file (GLenum shader_type, const std::string& file_path)
+static glsl_source_cache_t shader_sources(gl_constants::PATH_SHADER,
+		gl_constants::GLSL_FILENAME_IN_LINE_DIRECTIVE);
+
+GLuint glsl_load_shader_file (GLenum shader_type, const std::string& file_path,
+		const char* prologue, const glsl_defines_t& defines)
 {
 	assert(shader_type == GL_FRAGMENT_SHADER
 	    || shader_type == GL_VERTEX_SHADER
 	    || shader_type == GL_GEOMETRY_SHADER);
 
-	std::ostringstream src("", std::ios_base::app);
-	glsl_append_source(file_path, file_path, src, 0);
-
-	std::string s = src.str();
-	return glsl_load_shader_low(shader_type, s.c_str(), file_path.c_str());
+	const glsl_source_t& src = shader_sources.expand(file_path);
+	return glsl_load_shader_low(shader_type, src.text.c_str(), src.reported_path.c_str(),
+			glsl_prologue(prologue, defines).c_str());
 }
 
 void glsl_delete_shader (GLuint& shader)
@@ -115,7 +112,24 @@ void glsl_delete_shader (GLuint& shader)
 	shader = 0;
 }
 
-GLuint glsl_link_program (const GLuint* shaders, int num)
+static const struct {
+	const char* name;
+	glsl_block_binding_t binding;
+} known_blocks[] = {
+	{ "camera_block", GLSL_BINDING_CAMERA },
+};
+
+static void bind_known_blocks (GLuint program)
+{
+	for (const auto& b: known_blocks) {
+		const GLuint index = glGetUniformBlockIndex(program, b.name);
+		if (index != GL_INVALID_INDEX)
+			glUniformBlockBinding(program, index, b.binding);
+	}
+}
+
+/* Retrievable for the binary cache */
+static GLuint glsl_submit_link (const GLuint* shaders, int num, bool retrievable)
 {
 	if (shaders == nullptr || num == 0)
 		fatal("Tried to link a program without any shaders");
@@ -124,17 +138,26 @@ GLuint glsl_link_program (const GLuint* shaders, int num)
 	if (program_id == 0)
 		fatal("Failed to create program (was going to link %i shaders)", num);
 
+	if (retrievable)
+		glProgramParameteri(program_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	for (int i = 0; i < num; i++)
 		glAttachShader(program_id, shaders[i]);
 	glLinkProgram(program_id);
 	for (int i = 0; i < num; i++)
 		glDetachShader(program_id, shaders[i]);
+	return program_id;
+}
 
+/* Like glsl_shader_error */
+static std::string glsl_program_error (GLuint program_id, const std::string& name)
+{
 	int link_success = 0;
 	glGetProgramiv(program_id, GL_LINK_STATUS, &link_success);
 
-	if (link_success)
-		return program_id;
+	if (link_success) {
+		bind_known_blocks(program_id);
+		return "";
+	}
 
 	int log_length = 0;
 	glGetProgramiv(program_id, GL_INFO_LOG_LENGTH, &log_length);
@@ -142,7 +165,22 @@ GLuint glsl_link_program (const GLuint* shaders, int num)
 	log[log_length] = '\0';
 	glGetProgramInfoLog(program_id, log_length, &log_length, log);
 
-	fatal("Program with id %i failed to link. Log:\n%s", program_id, log);
+	return "Program " + name + " failed to link. Log:\n" + log;
+}
+
+static void glsl_check_program (GLuint program_id)
+{
+	const std::string error = glsl_program_error(program_id,
+			"with id " + std::to_string(program_id));
+	if (!error.empty())
+		fatal("%s", error.c_str());
+}
+
+GLuint glsl_link_program (const GLuint* shaders, int num)
+{
+	GLuint program = glsl_submit_link(shaders, num, false);
+	glsl_check_program(program);
+	return program;
 }
 
 GLuint glsl_link_program (std::initializer_list<GLuint> shaders)
@@ -152,6 +190,530 @@ GLuint glsl_link_program (std::initializer_list<GLuint> shaders)
 
 void glsl_delete_program (GLuint& program)
 {
+	gl_state_forget_program(program);
 	glDeleteProgram(program);
 	program = 0;
 }
+
+/* ================ PROGRAM BINARY CACHE ================ */
+
+static constexpr const char* PROGRAM_CACHE_DIR = "shader_cache/";
+static constexpr char PROGRAM_CACHE_MAGIC[4] = { 'G', 'L', 'P', 'B' };
+/* Bump whenever the layout or anything about the key changes */
+static constexpr uint32_t PROGRAM_CACHE_VERSION = 1;
+
+/* Followed by the binary */
+struct program_cache_header_t {
+	char magic[4];
+	uint32_t version;
+	uint64_t key;
+	uint32_t binary_format;
+	uint32_t binary_size;
+	/* What compiling it took, to tell what loading it saved */
+	double compile_ms;
+};
+
+static struct {
+	int num_loaded;
+	int num_compiled;
+	double load_ms;
+	double saved_ms;
+	double compile_ms;
+} cache_stats;
+
+static bool binaries_supported ()
+{
+	static const bool supported = [] () {
+		if (!GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary)
+			return false;
+		GLint num_formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+		return num_formats > 0;
+	} ();
+	return supported;
+}
+
+static uint64_t program_key (const char* prologue, const std::string& vert_src,
+		const std::string& frag_src)
+{
+	uint64_t h = hash_bytes(&PROGRAM_CACHE_VERSION, sizeof(PROGRAM_CACHE_VERSION));
+	for (GLenum e: { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+		const char* str = (const char*) glGetString(e);
+		h = hash_bytes(str, strlen(str) + 1, h);
+	}
+	h = hash_bytes(prologue, strlen(prologue) + 1, h);
+	h = hash_bytes(vert_src.data(), vert_src.size() + 1, h);
+	return hash_bytes(frag_src.data(), frag_src.size() + 1, h);
+}
+
+static std::string program_cache_path (uint64_t key)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long) key);
+	return PROGRAM_CACHE_DIR + std::string(name);
+}
+
+/*
+ * 0 if there's no binary. Whether the driver takes it is only known
+ * from the link status
+ */
+static GLuint load_program_binary (uint64_t key, double& compile_ms)
+{
+	mapped_file_t f;
+	if (!f.open(program_cache_path(key).c_str()) || f.size < sizeof(program_cache_header_t))
+		return 0;
+
+	program_cache_header_t h;
+	memcpy(&h, f.data, sizeof(h));
+	if (memcmp(h.magic, PROGRAM_CACHE_MAGIC, sizeof(PROGRAM_CACHE_MAGIC)) != 0
+	 || h.version != PROGRAM_CACHE_VERSION
+	 || h.key != key
+	 || h.binary_size != f.size - sizeof(h))
+		return 0;
+
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, h.binary_format, f.data + sizeof(h), h.binary_size);
+	compile_ms = h.compile_ms;
+	return program;
+}
+
+static void save_program_binary (uint64_t key, GLuint program, double compile_ms,
+		const std::string& name)
+{
+	GLint size = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+	if (size <= 0)
+		return;
+
+	std::vector<char> data(sizeof(program_cache_header_t) + size);
+	program_cache_header_t h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, PROGRAM_CACHE_MAGIC, sizeof(PROGRAM_CACHE_MAGIC));
+	h.version = PROGRAM_CACHE_VERSION;
+	h.key = key;
+	GLenum format;
+	glGetProgramBinary(program, size, &size, &format, data.data() + sizeof(h));
+	h.binary_format = format;
+	h.binary_size = size;
+	h.compile_ms = compile_ms;
+	memcpy(data.data(), &h, sizeof(h));
+
+	/*
+	 * Write to the side first so that a half-written binary is never seen,
+	 * to a file of this thread as warming up may write the same one
+	 */
+	std::error_code err;
+	std::filesystem::create_directories(PROGRAM_CACHE_DIR, err);
+	const std::string path = program_cache_path(key);
+	const size_t thread_id = std::hash<std::thread::id>()(std::this_thread::get_id());
+	const std::string tmp_path = path + "." + std::to_string(thread_id) + ".tmp";
+	FILE* f = fopen(tmp_path.c_str(), "wb");
+	bool ok = f != nullptr
+	       && fwrite(data.data(), 1, sizeof(h) + size, f) == sizeof(h) + size;
+	if (f != nullptr)
+		ok = (fclose(f) == 0) && ok;
+	if (ok)
+		std::filesystem::rename(tmp_path, path, err);
+	if (!ok || err) {
+		std::filesystem::remove(tmp_path, err);
+		warning("Program %s: cannot write cache %s", name.c_str(), path.c_str());
+	}
+}
+
+/* ================ PROGRAMS ================ */
+
+/* A compile and link, or a binary load, that the driver may still be busy with */
+struct program_build_t {
+	GLuint program;
+	bool from_binary;
+	uint64_t key;
+	double t_start;
+	/* Of the cached binary, while it's loading */
+	double compile_ms;
+	GLuint shaders[2];
+	std::string reported_paths[2];
+	/* To compile after all if the driver won't take the binary */
+	std::string sources[2];
+};
+
+struct program_entry_t {
+	std::string name;
+	std::string paths[2];
+	/* With the defines */
+	std::string prologue;
+	/* Of the paths and the prologue, to find the entry of a permutation */
+	uint64_t permutation_key;
+	/* Submits that haven't been deleted yet */
+	uint32_t num_users;
+	/* 0 until the first build is done, then swapped on each reload */
+	GLuint program;
+	bool building;
+	/* A file changed while it was building, so it's built again after */
+	bool stale;
+	program_build_t build;
+};
+
+static std::vector<program_entry_t> programs;
+static std::unordered_map<uint64_t, uint32_t> program_of_permutation;
+static int num_pending;
+static bool has_parallel_compile;
+static bool startup_reported;
+glsl_reload_status_t glsl_reload_status;
+
+void glsl_init ()
+{
+	has_parallel_compile = GLEW_KHR_parallel_shader_compile
+	                    || GLEW_ARB_parallel_shader_compile;
+	if (GLEW_KHR_parallel_shader_compile)
+		glMaxShaderCompilerThreadsKHR(0xffffffff);
+	else if (GLEW_ARB_parallel_shader_compile)
+		glMaxShaderCompilerThreadsARB(0xffffffff);
+	info("Shaders: %s", has_parallel_compile ? "compiled in parallel"
+	                                         : "no parallel compile, compiled on first use");
+}
+
+static void submit_compile (program_build_t& b, const std::string& prologue, bool retrievable)
+{
+	static const GLenum types[2] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+	for (int i = 0; i < 2; i++) {
+		b.shaders[i] = glsl_submit_shader(types[i], b.sources[i].c_str(),
+				b.reported_paths[i].c_str(), prologue.c_str());
+	}
+	b.program = glsl_submit_link(b.shaders, 2, retrievable);
+	b.from_binary = false;
+}
+
+/* Preprocesses now, the rest is up to the driver */
+static void start_build (program_entry_t& e)
+{
+	program_build_t& b = e.build;
+	b.t_start = time_seconds();
+	for (int i = 0; i < 2; i++) {
+		const glsl_source_t& src = shader_sources.expand(e.paths[i]);
+		b.sources[i] = src.text;
+		b.reported_paths[i] = src.reported_path;
+	}
+
+	const bool use_cache = binaries_supported();
+	b.key = use_cache ? program_key(e.prologue.c_str(), b.sources[0], b.sources[1]) : 0;
+	b.program = use_cache ? load_program_binary(b.key, b.compile_ms) : 0;
+	b.from_binary = b.program != 0;
+	if (!b.from_binary)
+		submit_compile(b, e.prologue, use_cache);
+
+	e.building = true;
+	num_pending++;
+}
+
+static uint64_t permutation_key (const std::string& vert_path, const std::string& frag_path,
+		const std::string& prologue)
+{
+	uint64_t h = hash_bytes(vert_path.data(), vert_path.size() + 1);
+	h = hash_bytes(frag_path.data(), frag_path.size() + 1, h);
+	return hash_bytes(prologue.data(), prologue.size(), h);
+}
+
+glsl_program_t glsl_submit_program (const std::string& vert_path,
+		const std::string& frag_path, const char* prologue, const glsl_defines_t& defines)
+{
+	const std::string full_prologue = glsl_prologue(prologue, defines);
+	const uint64_t key = permutation_key(vert_path, frag_path, full_prologue);
+	auto it = program_of_permutation.find(key);
+	if (it != program_of_permutation.end()) {
+		programs[it->second].num_users++;
+		return { it->second };
+	}
+
+	program_entry_t e;
+	e.name = vert_path + "+" + frag_path;
+	if (!defines.empty()) {
+		e.name += " [";
+		for (size_t i = 0; i < defines.size(); i++)
+			e.name += (i == 0 ? "" : ", ") + defines[i];
+		e.name += "]";
+	}
+	e.paths[0] = vert_path;
+	e.paths[1] = frag_path;
+	e.prologue = full_prologue;
+	e.permutation_key = key;
+	e.num_users = 1;
+	e.program = 0;
+	e.stale = false;
+	programs.push_back(std::move(e));
+	program_of_permutation[key] = programs.size() - 1;
+	start_build(programs.back());
+	return { (uint32_t) programs.size() - 1 };
+}
+
+/*
+ * Blocks until the driver is done with the build, then checks how that
+ * went. The first build of a program has to work, reloads may fail
+ */
+static void finish_build (program_entry_t& e)
+{
+	program_build_t& b = e.build;
+	if (b.from_binary) {
+		int linked = 0;
+		glGetProgramiv(b.program, GL_LINK_STATUS, &linked);
+		if (linked) {
+			const double load_ms = (time_seconds() - b.t_start) * 1e3;
+			cache_stats.num_loaded++;
+			cache_stats.load_ms += load_ms;
+			cache_stats.saved_ms += b.compile_ms - load_ms;
+		} else {
+			/* A driver update, most likely */
+			glDeleteProgram(b.program);
+			submit_compile(b, e.prologue, true);
+		}
+	}
+
+	std::string error;
+	if (!b.from_binary) {
+		for (int i = 0; i < 2 && error.empty(); i++)
+			error = glsl_shader_error(b.shaders[i], b.reported_paths[i].c_str());
+		if (error.empty())
+			error = glsl_program_error(b.program, e.name);
+		for (GLuint& s: b.shaders)
+			glsl_delete_shader(s);
+	}
+
+	const bool reload = e.program != 0;
+	if (!error.empty() && !reload)
+		fatal("%s", error.c_str());
+
+	if (!error.empty()) {
+		/* The old one keeps being used until it's fixed */
+		glsl_delete_program(b.program);
+		glsl_reload_status.num_failed++;
+		glsl_reload_status.log = error;
+		warning("%s", error.c_str());
+	} else {
+		if (!b.from_binary) {
+			/* Until it was seen done, with parallel compiles */
+			const double compile_ms = (time_seconds() - b.t_start) * 1e3;
+			cache_stats.num_compiled++;
+			cache_stats.compile_ms += compile_ms;
+			if (binaries_supported())
+				save_program_binary(b.key, b.program, compile_ms, e.name);
+		}
+		/* Block bindings aren't part of a binary, and linking set them already */
+		bind_known_blocks(b.program);
+
+		if (reload) {
+			glsl_delete_program(e.program);
+			glsl_reload_status.num_reloaded++;
+			glsl_reload_status.log.clear();
+			info("Program %s reloaded", e.name.c_str());
+		}
+		e.program = b.program;
+	}
+
+	for (std::string& src: b.sources)
+		src = std::string();
+	e.building = false;
+	num_pending--;
+}
+
+/* Without the extension, there's no asking without waiting */
+static bool build_done (const program_entry_t& e)
+{
+	int done = 1;
+	if (has_parallel_compile)
+		glGetProgramiv(e.build.program, GL_COMPLETION_STATUS_KHR, &done);
+	return done;
+}
+
+bool glsl_program_ready (glsl_program_t p)
+{
+	program_entry_t& e = programs[p.index];
+	if (e.program != 0)
+		return true;
+	if (!build_done(e))
+		return false;
+	finish_build(e);
+	return true;
+}
+
+GLuint glsl_program (glsl_program_t p)
+{
+	program_entry_t& e = programs[p.index];
+	if (e.program == 0)
+		finish_build(e);
+	return e.program;
+}
+
+/* Rebuilds the programs made of changed files */
+static void reload_changed ()
+{
+	static std::vector<std::string> changed;
+	changed.clear();
+	if (!file_watch_changes(changed))
+		return;
+
+	for (const std::string& file: changed) {
+		for (const std::string& root: shader_sources.invalidate(file)) {
+			for (program_entry_t& e: programs) {
+				if (e.paths[0] != root && e.paths[1] != root)
+					continue;
+				if (e.building)
+					e.stale = true;
+				else
+					start_build(e);
+			}
+		}
+	}
+}
+
+void glsl_poll_programs ()
+{
+	reload_changed();
+	if (num_pending == 0)
+		return;
+	for (program_entry_t& e: programs) {
+		if (!e.building || !build_done(e))
+			continue;
+		finish_build(e);
+		if (e.stale) {
+			e.stale = false;
+			start_build(e);
+		}
+	}
+
+	if (num_pending == 0 && !startup_reported) {
+		glsl_cache_report();
+		startup_reported = true;
+	}
+}
+
+void glsl_delete_program (glsl_program_t p)
+{
+	program_entry_t& e = programs[p.index];
+	if (--e.num_users > 0)
+		return;
+	if (e.building)
+		finish_build(e);
+	glsl_delete_program(e.program);
+	/* The entry stays, with nothing to reload */
+	program_of_permutation.erase(e.permutation_key);
+	e.paths[0] = e.paths[1] = "";
+}
+
+void glsl_use_embedded_shaders ()
+{
+	shader_sources.use_embedded(glsl_embedded_shaders, glsl_num_embedded_shaders);
+	info("Shaders: %i embedded in the binary, --shaders-from-disk to edit them live",
+			glsl_num_embedded_shaders);
+}
+
+void glsl_hot_reload_start ()
+{
+	if (file_watch_start(gl_constants::PATH_SHADER))
+		info("Shaders: reloaded when %s changes", gl_constants::PATH_SHADER);
+}
+
+/* ================ WARMING UP ================ */
+
+/* What the thread needs, made on the main one */
+struct warm_job_t {
+	std::string name;
+	std::string prologue;
+	std::string sources[2];
+	std::string reported_paths[2];
+	uint64_t key;
+};
+
+static std::thread warm_thread;
+
+/* Builds on the worker context, for the binaries only */
+static void warm_up (std::vector<warm_job_t> jobs)
+{
+	if (!render_worker_context_begin())
+		return;
+
+	const double t_start = time_seconds();
+	int num_built = 0;
+	for (warm_job_t& j: jobs) {
+		const double t_job = time_seconds();
+		program_build_t b;
+		b.sources[0] = std::move(j.sources[0]);
+		b.sources[1] = std::move(j.sources[1]);
+		b.reported_paths[0] = std::move(j.reported_paths[0]);
+		b.reported_paths[1] = std::move(j.reported_paths[1]);
+		submit_compile(b, j.prologue, true);
+
+		/* Left for the main thread to report, when the program is used */
+		std::string error;
+		for (int i = 0; i < 2 && error.empty(); i++)
+			error = glsl_shader_error(b.shaders[i], b.reported_paths[i].c_str());
+		if (error.empty())
+			error = glsl_program_error(b.program, j.name);
+		if (error.empty()) {
+			save_program_binary(j.key, b.program, (time_seconds() - t_job) * 1e3, j.name);
+			num_built++;
+		}
+		for (GLuint& s: b.shaders)
+			glDeleteShader(s);
+		glDeleteProgram(b.program);
+	}
+	render_worker_context_end();
+
+	info("Shader cache: warmed up %i programs in %.1f ms in the background",
+			num_built, (time_seconds() - t_start) * 1e3);
+}
+
+void glsl_precompile (const std::vector<glsl_permutation_t>& list)
+{
+	if (!binaries_supported() || render_context.sdl_worker_gl_context == nullptr) {
+		info("Shader cache: not warmed up, there's %s",
+				binaries_supported() ? "no worker context" : "no program binary format");
+		return;
+	}
+
+	std::vector<warm_job_t> jobs;
+	for (const glsl_permutation_t& p: list) {
+		warm_job_t j;
+		j.name = std::string(p.vert_path) + "+" + p.frag_path;
+		j.prologue = glsl_prologue(p.prologue, p.defines);
+		const char* paths[2] = { p.vert_path, p.frag_path };
+		for (int i = 0; i < 2; i++) {
+			const glsl_source_t& src = shader_sources.expand(paths[i]);
+			j.sources[i] = src.text;
+			j.reported_paths[i] = src.reported_path;
+		}
+		j.key = program_key(j.prologue.c_str(), j.sources[0], j.sources[1]);
+
+		/* Already there, if the sources are the same as last time */
+		const std::string path = program_cache_path(j.key);
+		if (!std::filesystem::exists(path))
+			jobs.push_back(std::move(j));
+	}
+	if (jobs.empty())
+		return;
+
+	if (warm_thread.joinable())
+		warm_thread.join();
+	warm_thread = std::thread(warm_up, std::move(jobs));
+}
+
+void glsl_deinit ()
+{
+	if (warm_thread.joinable())
+		warm_thread.join();
+	file_watch_stop();
+}
+
+void glsl_cache_report ()
+{
+	info("Shader sources: %u files read for %u expanded",
+			shader_sources.num_reads, shader_sources.num_expansions);
+	if (!binaries_supported()) {
+		info("Shader cache: the driver has no program binary formats, "
+		     "compiled %i programs in %.1f ms",
+		     cache_stats.num_compiled, cache_stats.compile_ms);
+		return;
+	}
+	info("Shader cache: %i programs loaded in %.1f ms, saving %.1f ms; "
+	     "%i compiled in %.1f ms",
+	     cache_stats.num_loaded, cache_stats.load_ms, cache_stats.saved_ms,
+	     cache_stats.num_compiled, cache_stats.compile_ms);
+}
@@ -2,13 +2,112 @@
 #define GL_GLSL_H
 
 #include "gl.h"
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <vector>
 
-GLuint glsl_load_shader_file (GLenum shader_type, const std::string& file_path);
+/*
+ * What goes before the source: the #version and extensions. Shaders are
+ * for GL 3.3 unless they need something from the 4.3 path
+ */
+extern const char* const GLSL_PROLOGUE_330;
+extern const char* const GLSL_PROLOGUE_430;
+
+/*
+ * Permutations of a shader: defines put after the prologue, each as
+ * "NAME" or "NAME value", so one file can have its features turned on
+ * and off when it's compiled rather than branch on them when it runs
+ */
+typedef std::vector<std::string> glsl_defines_t;
+
+GLuint glsl_load_shader_file (GLenum shader_type, const std::string& file_path,
+		const char* prologue = GLSL_PROLOGUE_330, const glsl_defines_t& defines = {});
 GLuint glsl_load_shader_string (GLenum shader_type, const char* source);
 void glsl_delete_shader (GLuint& shader);
 
+/*
+ * Binding points of the uniform blocks that any program may have. Linking
+ * binds the blocks, found by name, so shaders just #include them
+ */
+enum glsl_block_binding_t {
+	/* camera_block, from camera.glsl */
+	GLSL_BINDING_CAMERA = 0,
+};
+
 GLuint glsl_link_program (const GLuint* shaders, int num_shaders);
 GLuint glsl_link_program (std::initializer_list<GLuint> shaders);
 void glsl_delete_program (GLuint& program);
 
+/* Sets up parallel compiling, where there is any. After GLEW */
+void glsl_init ();
+void glsl_deinit ();
+
+/*
+ * A vertex and a fragment shader, compiled and linked in the background
+ * where the driver has KHR_parallel_shader_compile, or by the time it's
+ * first used otherwise. Unless the program binary is in the cache: those
+ * are keyed by the preprocessed sources with the prologue, and the GL
+ * vendor, renderer and version; anything that doesn't match or load is
+ * compiled again
+ */
+struct glsl_program_t {
+	uint32_t index;
+};
+
+/*
+ * Preprocesses now, the rest is up to the driver. Submitting the same
+ * files with the same prologue and defines again gives the same program,
+ * which is deleted once each submit has been
+ */
+glsl_program_t glsl_submit_program (const std::string& vert_path,
+		const std::string& frag_path, const char* prologue = GLSL_PROLOGUE_330,
+		const glsl_defines_t& defines = {});
+/* Whether it can be used without waiting. Without the extension, it waits */
+bool glsl_program_ready (glsl_program_t program);
+/* Waits for it if it's not ready, which is also where errors are fatal */
+GLuint glsl_program (glsl_program_t program);
+void glsl_delete_program (glsl_program_t program);
+
+/* Once a frame: finishes what's ready and starts reloads, without waiting */
+void glsl_poll_programs ();
+
+/* How many programs came from the cache and the time that saved */
+void glsl_cache_report ();
+
+/*
+ * Programs are built again when a file they're made of changes, in the
+ * background like the first time, and swapped in once they link. If they
+ * don't, the old one stays and the log is kept here until a build works
+ */
+struct glsl_reload_status_t {
+	uint32_t num_reloaded;
+	uint32_t num_failed;
+	std::string log;
+};
+extern glsl_reload_status_t glsl_reload_status;
+
+void glsl_hot_reload_start ();
+
+/*
+ * Takes the shaders from those the build expanded into the binary, and
+ * only reads from disk those it doesn't have. Before anything is submitted
+ */
+void glsl_use_embedded_shaders ();
+
+struct glsl_permutation_t {
+	const char* vert_path;
+	const char* frag_path;
+	glsl_defines_t defines;
+	const char* prologue = GLSL_PROLOGUE_330;
+};
+
+/*
+ * Compiles those that aren't in the binary cache on the worker context,
+ * in a thread of its own, so that they load from it when they're first
+ * submitted. It's only the binary cache that's warmed up, so without
+ * program binaries this does nothing
+ */
+void glsl_precompile (const std::vector<glsl_permutation_t>& list);
+
 #endif /* GL_GLSL_H */
@@ -1,15 +1,36 @@
 #include "gl_immediate.h"
+#include "gl_camera.h"
 #include "gl_glsl.h"
+#include "util.h"
+#include <algorithm>
+#include <cstring>
+#include <glm/gtc/packing.hpp>
 #include <vector>
 
 namespace imm
 {
 
-static GLuint vao;
+/*
+ * Vertices are written straight into a big buffer that is mapped the
+ * whole time (ARB_buffer_storage), or for the duration of a begin/end
+ * without synchronization otherwise. Each end() draws from where the
+ * batch was written, and the next batch continues after it.
+ *
+ * The buffer is split into segments; a fence is put after the draws
+ * that used a segment, and waited for before the segment is written
+ * again on the next lap around, which normally has long been passed.
+ */
+static constexpr size_t RING_SIZE = 8 << 20;
+static constexpr int RING_SEGMENTS = 4;
+static constexpr size_t SEGMENT_SIZE = RING_SIZE / RING_SEGMENTS;
+/* A batch gets moved to the start when it runs into the end */
+static constexpr size_t MAX_BATCH_SIZE = RING_SIZE / 2;
+
 static GLuint vbo;
 static GLenum current_render_mode;
 static bool after_begin;
 
+/* The current attributes, as they were set */
 struct vert {
 	vec3 position;
 	vec3 normal;
@@ -18,40 +39,424 @@ struct vert {
 };
 
 static vert current_vertex;
-static std::vector<vert> buffer;
 
-void init ()
+/*
+ * In the buffer, a vertex only has the attributes that change during its
+ * batch, the others are given to the draw as constants. Positions stay
+ * floats, normals are packed as 10:10:10:2 and colors as RGBA8, so lines
+ * with a color each take 16 bytes per vertex instead of 44.
+ */
+enum : int {
+	FORMAT_NORMAL = 1,
+	FORMAT_TEX_COORD = 2,
+	FORMAT_COLOR = 4,
+	FORMAT_FULL = FORMAT_NORMAL | FORMAT_TEX_COORD | FORMAT_COLOR,
+	NUM_FORMATS = 8,
+};
+
+struct vertex_format_t {
+	GLuint vao;
+	size_t stride;
+	size_t normal_offset;
+	size_t tex_coord_offset;
+	size_t color_offset;
+};
+static vertex_format_t formats[NUM_FORMATS];
+/* Off to always use FORMAT_FULL, for comparison */
+static bool compact_formats;
+
+static bool ring_persistent;
+/* Where byte offset 0 of the buffer would be mapped */
+static char* ring_map_base;
+static size_t ring_mapped_from;
+static size_t ring_head;
+/* The segment being written into */
+static int ring_segment;
+static GLsync segment_fence[RING_SEGMENTS];
+
+/*
+ * The batch between begin() and end(). Its format is picked at the first
+ * vertex: the attributes that changed in the last batch, as batches tend
+ * to come in runs of the same kind, with everything else taken as
+ * constant. When one of those changes later on, the batch is written
+ * again in a format with it; that's what the copy of its vertices is for
+ */
+static size_t batch_start;
+/* Where the batch could start, before it's aligned to its format */
+static size_t batch_origin;
+static int batch_format;
+static vert batch_constants;
+static std::vector<vert> batch_vertices;
+static int batch_num_vertices;
+/* Bits of the segments the batch is in, to be fenced after it's drawn */
+static unsigned batch_segments;
+/* Attributes that changed within the batch, and within the last one */
+static int batch_changed;
+static int last_batch_changed;
+
+/*
+ * What a draw call depends on besides the vertices. Fixed-function
+ * state isn't tracked: flush() before changing any of it
+ */
+struct draw_state_t {
+	GLuint program;
+	mat4 transform;
+
+	bool operator== (const draw_state_t& o) const
+	{
+		return program == o.program && transform == o.transform;
+	}
+};
+static draw_state_t current_state;
+
+/*
+ * Batches aren't drawn in end(), but wait for the next batch in case it
+ * can be drawn along with them: same state and format, a primitive type
+ * that can be concatenated, and its vertices right after theirs
+ */
+struct pending_draw_t {
+	GLenum mode;
+	draw_state_t state;
+	int format;
+	vert constants;
+	size_t first;
+	size_t end;
+	unsigned segments;
+};
+static pending_draw_t pending;
+static bool have_pending;
+static bool merge_batches;
+
+static void flush_pending ();
+
+/*
+ * Quads are drawn as indexed triangles; the indices are the same for every
+ * quad relative to its first vertex, so one buffer of them serves everyone
+ */
+static GLuint quad_ibo;
+static int quad_ibo_capacity;
+
+static void reserve_quad_indices (int num_quads)
 {
-	vao = gl_gen_vertex_array();
-	glBindVertexArray(vao);
+	if (num_quads <= quad_ibo_capacity)
+		return;
 
-	vbo = gl_gen_buffer();
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	quad_ibo_capacity = ceil_po2(num_quads);
+	std::vector<uint32_t> indices(6 * quad_ibo_capacity);
+	for (uint32_t q = 0; q < quad_ibo_capacity; q++) {
+		const uint32_t pattern[6] = { 0, 1, 2, 0, 2, 3 };
+		for (int k = 0; k < 6; k++)
+			indices[6 * q + k] = 4 * q + pattern[k];
+	}
+
+	/* Every format's VAO has it as its element buffer */
+	gl_bind_vertex_array(formats[0].vao);
+	gl_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, quad_ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * indices.size(),
+			indices.data(), GL_STATIC_DRAW);
+}
+
+static void init_format (int format)
+{
+	vertex_format_t& f = formats[format];
+	size_t offset = sizeof(vec3);
+	if (format & FORMAT_NORMAL) {
+		f.normal_offset = offset;
+		offset += sizeof(uint32_t);
+	}
+	if (format & FORMAT_TEX_COORD) {
+		f.tex_coord_offset = offset;
+		offset += sizeof(vec2);
+	}
+	if (format & FORMAT_COLOR) {
+		f.color_offset = offset;
+		offset += sizeof(uint32_t);
+	}
+	f.stride = offset;
+
+	f.vao = gl_gen_vertex_array();
+	gl_bind_vertex_array(f.vao);
+	gl_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, quad_ibo);
+	gl_bind_buffer(GL_ARRAY_BUFFER, vbo);
 
 	using namespace attrib_loc;
-	gl_vertex_attrib_ptr(POSITION, 3, GL_FLOAT, false,
-	                     sizeof(vert), offsetof(vert, position));
-	gl_vertex_attrib_ptr(NORMAL, 3, GL_FLOAT, true,
-	                     sizeof(vert), offsetof(vert, normal));
-	gl_vertex_attrib_ptr(TEX_COORD, 2, GL_FLOAT, false,
-	                     sizeof(vert), offsetof(vert, tex_coord));
-	gl_vertex_attrib_ptr(COLOR, 3, GL_FLOAT, false,
-	                     sizeof(vert), offsetof(vert, color));
+	gl_vertex_attrib_ptr(POSITION, 3, GL_FLOAT, false, f.stride, 0);
+	if (format & FORMAT_NORMAL) {
+		gl_vertex_attrib_ptr(NORMAL, 4, GL_INT_2_10_10_10_REV, true,
+		                     f.stride, f.normal_offset);
+	}
+	if (format & FORMAT_TEX_COORD) {
+		gl_vertex_attrib_ptr(TEX_COORD, 2, GL_FLOAT, false,
+		                     f.stride, f.tex_coord_offset);
+	}
+	if (format & FORMAT_COLOR) {
+		gl_vertex_attrib_ptr(COLOR, 4, GL_UNSIGNED_BYTE, true,
+		                     f.stride, f.color_offset);
+	}
+}
+
+/* The attributes that aren't in the format are the same */
+static bool same_constants (int format, const vert& a, const vert& b)
+{
+	return ((format & FORMAT_NORMAL) || a.normal == b.normal)
+	    && ((format & FORMAT_TEX_COORD) || a.tex_coord == b.tex_coord)
+	    && ((format & FORMAT_COLOR) || a.color == b.color);
+}
+
+static void encode_vertex (char* dst, const vert& v, int format)
+{
+	const vertex_format_t& f = formats[format];
+	/* Put together here, the mapping may be write-combined */
+	char buf[sizeof(vert)];
+	memcpy(buf, &v.position, sizeof(vec3));
+	if (format & FORMAT_NORMAL) {
+		const uint32_t n = glm::packSnorm3x10_1x2(vec4(v.normal, 0.0));
+		memcpy(buf + f.normal_offset, &n, sizeof(n));
+	}
+	if (format & FORMAT_TEX_COORD)
+		memcpy(buf + f.tex_coord_offset, &v.tex_coord, sizeof(vec2));
+	if (format & FORMAT_COLOR) {
+		const uint32_t c = glm::packUnorm4x8(vec4(v.color, 1.0));
+		memcpy(buf + f.color_offset, &c, sizeof(c));
+	}
+	memcpy(dst, buf, f.stride);
+}
+
+static int segment_of (size_t offset)
+{
+	return offset / SEGMENT_SIZE;
+}
+
+static void ring_map (size_t from)
+{
+	ring_mapped_from = from;
+	if (ring_persistent)
+		return;
+	/* Right at the end: the first vertex will wrap around and map */
+	if (from >= RING_SIZE) {
+		ring_map_base = nullptr;
+		return;
+	}
+
+	gl_bind_buffer(GL_ARRAY_BUFFER, vbo);
+	void* p = glMapBufferRange(GL_ARRAY_BUFFER, from, RING_SIZE - from,
+			GL_MAP_WRITE_BIT
+			| GL_MAP_UNSYNCHRONIZED_BIT
+			| GL_MAP_FLUSH_EXPLICIT_BIT);
+	if (p == nullptr)
+		fatal("imm: failed to map the vertex buffer");
+	ring_map_base = (char*) p - from;
+}
+
+static void ring_unmap (size_t to)
+{
+	if (ring_persistent || ring_map_base == nullptr)
+		return;
+
+	gl_bind_buffer(GL_ARRAY_BUFFER, vbo);
+	to = std::min(to, RING_SIZE);
+	if (to > ring_mapped_from)
+		glFlushMappedBufferRange(GL_ARRAY_BUFFER, 0, to - ring_mapped_from);
+	glUnmapBuffer(GL_ARRAY_BUFFER);
+	ring_map_base = nullptr;
+}
+
+static void wait_for_segment (int segment)
+{
+	GLsync& fence = segment_fence[segment];
+	if (fence == nullptr)
+		return;
+
+	GLenum result = glClientWaitSync(fence, 0, 0);
+	if (result == GL_TIMEOUT_EXPIRED) {
+		result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+		                          1'000'000'000);
+	}
+	if (result == GL_WAIT_FAILED || result == GL_TIMEOUT_EXPIRED)
+		warning("imm: waiting on the vertex buffer failed (0x%x)", result);
+
+	glDeleteSync(fence);
+	fence = nullptr;
+}
+
+/* Bits of segments first to last */
+static unsigned segment_bits (int first, int last)
+{
+	return ((1u << (last + 1)) - 1) & ~((1u << first) - 1);
+}
+
+/* Right after the last command that reads from the segments */
+static void fence_segments (unsigned segments)
+{
+	for (int s = 0; s < RING_SEGMENTS; s++) {
+		if (!(segments & (1u << s)))
+			continue;
+		/* A later fence covers everything an earlier one did */
+		if (segment_fence[s] != nullptr)
+			glDeleteSync(segment_fence[s]);
+		segment_fence[s] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+}
+
+static void enter_segment (int segment)
+{
+	if (segment == ring_segment)
+		return;
+	wait_for_segment(segment);
+	ring_segment = segment;
+}
+
+/* The batch has run into the end of the buffer: move it to the start */
+static void ring_wrap ()
+{
+	const size_t stride = formats[batch_format].stride;
+	const size_t batch_size = ring_head - batch_start;
+	if (batch_size + stride > MAX_BATCH_SIZE) {
+		fatal("imm: more than %i vertices between begin() and end()",
+				(int) (MAX_BATCH_SIZE / stride));
+	}
+
+	ring_unmap(ring_head);
+	/* Everything drawn so far is fenced after this */
+	flush_pending();
+
+	const int last_target = segment_of(batch_size + stride - 1);
+	for (int s = 0; s <= last_target; s++)
+		wait_for_segment(s);
+
+	/* It can't be read back from the mapping, so the GPU moves it */
+	if (batch_size > 0) {
+		gl_bind_buffer(GL_COPY_READ_BUFFER, vbo);
+		gl_bind_buffer(GL_COPY_WRITE_BUFFER, vbo);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+				batch_start, 0, batch_size);
+		/* The batch may never be drawn, but the copy reads these */
+		fence_segments(segment_bits(segment_of(batch_start), RING_SEGMENTS - 1));
+	}
+
+	batch_start = 0;
+	/* Not written over by the CPU, as the copy may still be on its way */
+	batch_origin = batch_size;
+	batch_segments = segment_bits(0, last_target);
+	ring_head = batch_size;
+	ring_segment = last_target;
+	ring_map(0);
+}
+
+static void emit (const vert& v)
+{
+	const size_t stride = formats[batch_format].stride;
+	if (unlikely(ring_head + stride > RING_SIZE))
+		ring_wrap();
+	else
+		enter_segment(segment_of(ring_head + stride - 1));
+	batch_segments |= segment_bits(segment_of(ring_head), ring_segment);
+
+	encode_vertex(ring_map_base + ring_head, v, batch_format);
+	ring_head += stride;
+}
+
+/* Any offset into the batch has to be a whole number of vertices */
+static void align_batch_start ()
+{
+	const size_t stride = formats[batch_format].stride;
+	batch_start = std::min((batch_start + stride - 1) / stride * stride, RING_SIZE);
+	ring_head = batch_start;
+}
+
+/* One of the constant attributes changed in the middle of the batch */
+static void promote_batch (int format)
+{
+	batch_format = format;
+	/*
+	 * Written over again where it was if that's still in the segment
+	 * being written, otherwise after it, so as not to step back onto
+	 * a segment whose fence is recent
+	 */
+	batch_start = segment_of(batch_origin) == ring_segment ? batch_origin : ring_head;
+	align_batch_start();
+	for (const vert& v: batch_vertices)
+		emit(v);
+}
+
+static void ring_init (bool use_persistent)
+{
+	ring_persistent = use_persistent;
+	ring_head = 0;
+	ring_segment = 0;
+	batch_segments = 0;
+	for (GLsync& f: segment_fence)
+		f = nullptr;
+
+	gl_bind_buffer(GL_ARRAY_BUFFER, vbo);
+	if (ring_persistent) {
+		constexpr GLbitfield flags = GL_MAP_WRITE_BIT
+		                           | GL_MAP_PERSISTENT_BIT
+		                           | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_ARRAY_BUFFER, RING_SIZE, nullptr, flags);
+		ring_map_base = (char*) glMapBufferRange(GL_ARRAY_BUFFER,
+				0, RING_SIZE, flags);
+		if (ring_map_base == nullptr)
+			fatal("imm: failed to map the vertex buffer persistently");
+	} else {
+		glBufferData(GL_ARRAY_BUFFER, RING_SIZE, nullptr, GL_STREAM_DRAW);
+		ring_map_base = nullptr;
+	}
+}
+
+static void ring_deinit ()
+{
+	for (GLsync& f: segment_fence) {
+		if (f != nullptr)
+			glDeleteSync(f);
+		f = nullptr;
+	}
+	if (ring_persistent) {
+		gl_bind_buffer(GL_ARRAY_BUFFER, vbo);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+	}
+	ring_map_base = nullptr;
+}
+
+static void init_with (bool use_persistent)
+{
+	vbo = gl_gen_buffer();
+	gl_bind_buffer(GL_ARRAY_BUFFER, vbo);
+	ring_init(use_persistent);
+
+	quad_ibo = gl_gen_buffer();
+	for (int format = 0; format < NUM_FORMATS; format++)
+		init_format(format);
+	quad_ibo_capacity = 0;
+	reserve_quad_indices(1024);
 
 	after_begin = false;
+	have_pending = false;
+	merge_batches = true;
+	compact_formats = true;
+	last_batch_changed = 0;
+	current_state = { 0, mat4(1.0) };
 	current_vertex = { .position = vec3(0.0),
 	                   .normal = vec3(0.0),
 	                   .tex_coord = vec2(0.0),
 	                   .color = vec3(1.0) };
 }
 
+void init ()
+{
+	init_with(GLEW_ARB_buffer_storage);
+}
+
 void deinit ()
 {
-	buffer.clear();
 	after_begin = false;
+	have_pending = false;
 
-	glDeleteBuffers(1, &vbo);
-	glDeleteVertexArrays(1, &vao);
+	ring_deinit();
+	for (vertex_format_t& f: formats)
+		gl_delete_vertex_array(f.vao);
+	gl_delete_buffer(quad_ibo);
+	gl_delete_buffer(vbo);
 }
 
 void begin (GLenum render_mode)
@@ -60,7 +465,69 @@ void begin (GLenum render_mode)
 	after_begin = true;
 
 	current_render_mode = render_mode;
-	buffer.clear();
+
+	batch_start = ring_head;
+	batch_origin = ring_head;
+	batch_vertices.clear();
+	batch_num_vertices = 0;
+	batch_segments = 0;
+	ring_map(batch_start);
+}
+
+/* Of the modes whose draws can be concatenated, 0 for the others */
+static int vertices_per_primitive (GLenum mode)
+{
+	switch (mode) {
+	case GL_POINTS:    return 1;
+	case GL_LINES:     return 2;
+	case GL_TRIANGLES: return 3;
+	case GL_QUADS:     return 4;
+	default:           return 0;
+	}
+}
+
+static bool mode_can_merge (GLenum mode)
+{
+	return vertices_per_primitive(mode) > 0;
+}
+
+static void flush_pending ()
+{
+	if (!have_pending)
+		return;
+	have_pending = false;
+
+	gl_use_program(pending.state.program);
+	if (pending.state.program != 0) {
+		glUniformMatrix4fv(0, 1, GL_FALSE,
+				glm::value_ptr(pending.state.transform));
+	}
+
+	/* Attributes without an array take the current generic value */
+	using namespace attrib_loc;
+	if (!(pending.format & FORMAT_NORMAL))
+		glVertexAttrib3fv(NORMAL, glm::value_ptr(pending.constants.normal));
+	if (!(pending.format & FORMAT_TEX_COORD))
+		glVertexAttrib2fv(TEX_COORD, glm::value_ptr(pending.constants.tex_coord));
+	if (!(pending.format & FORMAT_COLOR))
+		glVertexAttrib3fv(COLOR, glm::value_ptr(pending.constants.color));
+
+	const vertex_format_t& f = formats[pending.format];
+	const int first = pending.first / f.stride;
+	const int count = (pending.end - pending.first) / f.stride;
+
+	if (pending.mode == GL_QUADS) {
+		reserve_quad_indices(count / 4);
+		gl_bind_vertex_array(f.vao);
+		glDrawElementsBaseVertex(GL_TRIANGLES, count / 4 * 6,
+				GL_UNSIGNED_INT, nullptr, first);
+	} else {
+		gl_bind_vertex_array(f.vao);
+		glDrawArrays(pending.mode, first, count);
+	}
+
+	/* The fences go after the draw, only then do they cover it */
+	fence_segments(pending.segments);
 }
 
 void end ()
@@ -68,16 +535,60 @@ void end ()
 	assert(after_begin);
 	after_begin = false;
 
-	glBindVertexArray(vao);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER,
-			sizeof(vert) * buffer.size(),
-			buffer.data(), GL_DYNAMIC_DRAW);
+	ring_unmap(ring_head);
+	batch_vertices.clear();
+	if (batch_num_vertices > 0)
+		last_batch_changed = batch_changed;
+
+	const GLenum mode = current_render_mode;
+	size_t batch_end = ring_head;
+	/*
+	 * Leftovers of an unfinished primitive would offset the ones after
+	 * them once merged; on their own they'd be dropped anyway
+	 */
+	if (mode_can_merge(mode)) {
+		const size_t primitive_size = vertices_per_primitive(mode) * formats[batch_format].stride;
+		batch_end -= (batch_end - batch_start) % primitive_size;
+	}
+
+	if (batch_end == batch_start)
+		return;
+
+	if (have_pending && merge_batches
+	 && mode_can_merge(mode)
+	 && pending.mode == mode
+	 && pending.end == batch_start
+	 && pending.state == current_state
+	 && pending.format == batch_format
+	 && same_constants(batch_format, pending.constants, batch_constants)) {
+		pending.end = batch_end;
+		pending.segments |= batch_segments;
+		return;
+	}
+
+	flush_pending();
+	pending = { mode, current_state, batch_format, batch_constants,
+	            batch_start, batch_end, batch_segments };
+	have_pending = true;
 
-	if (current_render_mode == GL_QUADS)
-		current_render_mode = GL_TRIANGLES;
+	if (!mode_can_merge(mode) || !merge_batches)
+		flush_pending();
+}
 
-	glDrawArrays(current_render_mode, 0, buffer.size());
+void flush ()
+{
+	assert(!after_begin);
+	flush_pending();
+}
+
+void use_program (GLuint program)
+{
+	current_state.program = program;
+}
+
+void set_transform (const mat4& transform)
+{
+	current_state.transform = transform;
 }
 
 void vertex (vec3 v)
@@ -85,28 +596,172 @@ void vertex (vec3 v)
 	assert(after_begin);
 	current_vertex.position = v;
 
-	buffer.push_back(current_vertex);
-
-	unsigned bs = buffer.size();
-	if (current_render_mode == GL_QUADS && bs % 6 == 4) {
-		buffer.push_back(buffer[bs - 4]);
-		buffer.push_back(buffer[bs - 2]);
+	if (batch_num_vertices == 0) {
+		batch_format = compact_formats ? last_batch_changed : FORMAT_FULL;
+		batch_changed = 0;
+		batch_constants = current_vertex;
+		align_batch_start();
 	}
+	batch_num_vertices++;
+	if (batch_format != FORMAT_FULL)
+		batch_vertices.push_back(current_vertex);
+
+	emit(current_vertex);
+}
+
+/* After setting an attribute; it may have to be added to the format */
+static void attribute_set (int attribute, bool same_as_constant)
+{
+	if (!after_begin || batch_num_vertices == 0 || same_as_constant)
+		return;
+	batch_changed |= attribute;
+	if (!(batch_format & attribute))
+		promote_batch(batch_format | attribute);
 }
 
 void color (vec3 c)
 {
 	current_vertex.color = c;
+	attribute_set(FORMAT_COLOR, c == batch_constants.color);
 }
 
 void normal (vec3 n)
 {
 	current_vertex.normal = n;
+	attribute_set(FORMAT_NORMAL, n == batch_constants.normal);
 }
 
 void tex_coord (vec2 t)
 {
 	current_vertex.tex_coord = t;
+	attribute_set(FORMAT_TEX_COORD, t == batch_constants.tex_coord);
+}
+
+/* ================ BENCHMARK ================ */
+
+/* What end() used to do: reallocate and copy the whole buffer every time */
+static double benchmark_frames_buffer_data (int num_frames, int pairs_per_frame)
+{
+	GLuint legacy_vao = gl_gen_vertex_array();
+	GLuint legacy_vbo = gl_gen_buffer();
+	gl_bind_vertex_array(legacy_vao);
+	gl_bind_buffer(GL_ARRAY_BUFFER, legacy_vbo);
+	gl_vertex_attrib_ptr(attrib_loc::POSITION, 3, GL_FLOAT, false,
+	                     sizeof(vert), offsetof(vert, position));
+	gl_vertex_attrib_ptr(attrib_loc::COLOR, 3, GL_FLOAT, false,
+	                     sizeof(vert), offsetof(vert, color));
+
+	std::vector<vert> buffer;
+	glFinish();
+	const double t_start = time_seconds();
+
+	for (int frame = 0; frame < num_frames; frame++) {
+		for (int i = 0; i < pairs_per_frame; i++) {
+			buffer.clear();
+			const float x = (i % 100) * 0.02 - 1.0;
+			const float y = (i / 100 % 100) * 0.02 - 1.0;
+			for (vec3 p: { vec3(x, y, 0), vec3(x + 0.01, y, 0),
+			               vec3(x + 0.01, y + 0.01, 0),
+			               vec3(x, y, 0), vec3(x + 0.01, y + 0.01, 0),
+			               vec3(x, y + 0.01, 0) })
+				buffer.push_back({ p, vec3(0.0), vec2(0.0), vec3(1.0) });
+
+			gl_bind_vertex_array(legacy_vao);
+			gl_bind_buffer(GL_ARRAY_BUFFER, legacy_vbo);
+			glBufferData(GL_ARRAY_BUFFER, sizeof(vert) * buffer.size(),
+					buffer.data(), GL_DYNAMIC_DRAW);
+			glDrawArrays(GL_TRIANGLES, 0, buffer.size());
+		}
+		glFinish();
+	}
+
+	const double t = time_seconds() - t_start;
+	gl_delete_buffer(legacy_vbo);
+	gl_delete_vertex_array(legacy_vao);
+	return t;
+}
+
+static double benchmark_frames_imm (int num_frames, int pairs_per_frame)
+{
+	glFinish();
+	const double t_start = time_seconds();
+
+	for (int frame = 0; frame < num_frames; frame++) {
+		for (int i = 0; i < pairs_per_frame; i++) {
+			const float x = (i % 100) * 0.02 - 1.0;
+			const float y = (i / 100 % 100) * 0.02 - 1.0;
+			begin(GL_QUADS);
+			color({ 1, 0, 0 });
+			vertex({ x, y, 0 });
+			color({ 0, 1, 0 });
+			vertex({ x + 0.01, y, 0 });
+			color({ 0, 0, 1 });
+			vertex({ x + 0.01, y + 0.01, 0 });
+			color({ 1, 1, 1 });
+			vertex({ x, y + 0.01, 0 });
+			end();
+		}
+		flush();
+		glFinish();
+	}
+
+	return time_seconds() - t_start;
+}
+
+void benchmark (int num_frames)
+{
+	constexpr int PAIRS_PER_FRAME = 10'000;
+
+	const glsl_program_t mesh_program = glsl_submit_program("mesh.vert", "mesh.frag");
+	const GLuint program = glsl_program(mesh_program);
+	gl_use_program(program);
+	gl_viewport(0, 0, render_context.resolution_x, render_context.resolution_y);
+	use_program(program);
+	/* Everything is drawn in clip space */
+	gl_camera_upload(mat4(1.0), mat4(1.0),
+			vec2(render_context.resolution_x, render_context.resolution_y));
+
+	printf("imm: %i frames of %i begin/end pairs\n", num_frames, PAIRS_PER_FRAME);
+	auto report = [num_frames] (const char* what, double seconds) {
+		printf("  %-36s %8.2f ms/frame\n", what, seconds * 1e3 / num_frames);
+	};
+
+	report("glBufferData per end()",
+	       benchmark_frames_buffer_data(num_frames, PAIRS_PER_FRAME));
+
+	const bool had_persistent = ring_persistent;
+
+	struct config_t {
+		const char* name;
+		bool persistent;
+		bool merge;
+		bool compact;
+	};
+	const config_t configs[] = {
+		{ "ring, unsynchronized",                 false, false, true },
+		{ "ring, unsynchronized, batched",        false, true,  true },
+		{ "ring, unsynchronized, batched, full",  false, true,  false },
+		{ "ring, persistent",                     true,  false, true },
+		{ "ring, persistent, batched",            true,  true,  true },
+		{ "ring, persistent, batched, full",      true,  true,  false },
+	};
+
+	for (const config_t& c: configs) {
+		if (c.persistent && !GLEW_ARB_buffer_storage)
+			continue;
+		deinit();
+		init_with(c.persistent);
+		use_program(program);
+		merge_batches = c.merge;
+		compact_formats = c.compact;
+		report(c.name, benchmark_frames_imm(num_frames, PAIRS_PER_FRAME));
+	}
+	if (!GLEW_ARB_buffer_storage)
+		printf("  ARB_buffer_storage is not supported\n");
+
+	deinit();
+	init_with(had_persistent);
+	glsl_delete_program(mesh_program);
 }
 
 } /* namespace imm */
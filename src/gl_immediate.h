@@ -6,8 +6,9 @@
 
 /*
  * An imitation of the old OpenGL immediate mode rendering,
- * with the principle of "getting something to draw", though
- * not efficiently at all.
+ * with the principle of "getting something to draw".
+ * Vertices are streamed through one big mapped buffer,
+ * so many small begin/end pairs are fine
  */
 
 namespace imm
@@ -19,11 +20,31 @@ void deinit ();
 void begin (GLenum mode);
 void end ();
 
+/*
+ * Batches with the same state are drawn together, when the next batch
+ * can't be or on flush(). Flush before changing any other GL state that
+ * the drawing depends on, and before the frame (or viewport) is done
+ */
+void flush ();
+
+/* The program to draw with, and its `layout (location = 0) uniform mat4` */
+void use_program (GLuint program);
+void set_transform (const mat4& transform);
+
+/*
+ * Attributes that stay the same through a batch are passed to the draw
+ * with glVertexAttrib*, which leaves them as the current generic values.
+ * Normals are stored with 10 bits per component and colors with 8, so
+ * normals should be unit length and colors within [0, 1]
+ */
 void vertex (vec3);
 void normal (vec3);
 void tex_coord (vec2);
 void color (vec3);
 
+/* --benchmark=imm: 10k begin/end pairs per frame, against glBufferData */
+void benchmark (int num_frames);
+
 namespace attrib_loc
 {
 static constexpr int POSITION = 0;
@@ -0,0 +1,256 @@
+#include "gl_upload.h"
+#include "util.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+/* Uploads waiting for the thread at a time, beyond that submitting waits */
+static constexpr uint32_t QUEUE_CAPACITY = 256;
+/* Parts start at multiples of this in the staging buffer */
+static constexpr size_t PART_ALIGNMENT = 16;
+
+struct upload_request_t {
+	uint32_t id;
+	std::vector<gl_upload_part_t> parts;
+	std::shared_ptr<const void> keep_alive;
+
+	/* Filled in on the upload thread */
+	GLuint buffer;
+	GLsync fence;
+	std::vector<size_t> offsets;
+};
+
+/* ================ QUEUE ================ */
+
+/*
+ * Bounded queue of pointers that any number of threads may push to and
+ * pop from without locks (Vyukov's). Each cell has a sequence number,
+ * which says whether it's for the next push or the next pop to take
+ */
+template <class T, uint32_t CAPACITY>
+struct ring_queue_t {
+	/* So that positions wrap around at 2^32 along with the cells */
+	static_assert((CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of two");
+
+	struct cell_t {
+		std::atomic<uint32_t> sequence;
+		T* item;
+	};
+	cell_t cells[CAPACITY];
+	alignas(64) std::atomic<uint32_t> head = 0;
+	alignas(64) std::atomic<uint32_t> tail = 0;
+
+	ring_queue_t ()
+	{
+		for (uint32_t i = 0; i < CAPACITY; i++)
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	/* False if it's full */
+	bool push (T* item)
+	{
+		uint32_t pos = tail.load(std::memory_order_relaxed);
+		while (true) {
+			cell_t& c = cells[pos % CAPACITY];
+			const int32_t diff = c.sequence.load(std::memory_order_acquire) - pos;
+			if (diff == 0) {
+				if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					c.item = item;
+					c.sequence.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = tail.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	/* nullptr if it's empty */
+	T* pop ()
+	{
+		uint32_t pos = head.load(std::memory_order_relaxed);
+		while (true) {
+			cell_t& c = cells[pos % CAPACITY];
+			const int32_t diff = c.sequence.load(std::memory_order_acquire) - (pos + 1);
+			if (diff == 0) {
+				if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					T* item = c.item;
+					c.sequence.store(pos + CAPACITY, std::memory_order_release);
+					return item;
+				}
+			} else if (diff < 0) {
+				return nullptr;
+			} else {
+				pos = head.load(std::memory_order_relaxed);
+			}
+		}
+	}
+};
+
+/* ================ UPLOAD THREAD ================ */
+
+static ring_queue_t<upload_request_t, QUEUE_CAPACITY> requests;
+static ring_queue_t<upload_request_t, QUEUE_CAPACITY> uploaded;
+/* Taken from `uploaded` by the renderer, waiting for their fences */
+static std::deque<upload_request_t*> in_flight;
+
+static std::thread upload_thread;
+static std::atomic<uint32_t> next_id = 1;
+
+/* Bumped on every submit, so that the thread about to sleep notices it */
+static std::atomic<uint32_t> submit_epoch;
+static std::atomic<bool> is_sleeping;
+static std::mutex wake_mutex;
+static std::condition_variable wake_cond;
+/* Set under wake_mutex */
+static std::atomic<bool> quit;
+
+/* On the worker context, so without the state cache of the main one */
+static void upload (upload_request_t& r)
+{
+	size_t size = 0;
+	for (const gl_upload_part_t& p: r.parts) {
+		r.offsets.push_back(size);
+		size += (p.size + PART_ALIGNMENT - 1) / PART_ALIGNMENT * PART_ALIGNMENT;
+	}
+
+	glGenBuffers(1, &r.buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, r.buffer);
+	/* Only ever read by the GPU, copying it where it goes */
+	glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STREAM_COPY);
+	for (size_t i = 0; i < r.parts.size(); i++)
+		glBufferSubData(GL_COPY_WRITE_BUFFER, r.offsets[i], r.parts[i].size, r.parts[i].data);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	r.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	/* The data has been copied by now */
+	r.parts.clear();
+	r.keep_alive.reset();
+}
+
+static void upload_loop ()
+{
+	while (true) {
+		const uint32_t epoch = submit_epoch.load();
+		upload_request_t* r = requests.pop();
+		if (r == nullptr) {
+			std::unique_lock<std::mutex> lock(wake_mutex);
+			if (quit)
+				break;
+			is_sleeping = true;
+			wake_cond.wait(lock, [epoch] { return submit_epoch.load() != epoch || quit.load(); });
+			is_sleeping = false;
+			continue;
+		}
+
+		/* Whatever is queued by now goes in one go */
+		if (!render_worker_context_begin())
+			fatal("Cannot upload without the worker GL context");
+		const double t_start = time_seconds();
+		int num_uploads = 0;
+		size_t num_bytes = 0;
+		for (; r != nullptr; r = requests.pop()) {
+			for (const gl_upload_part_t& p: r->parts)
+				num_bytes += p.size;
+			upload(*r);
+			num_uploads++;
+			/* The fences have to get to the GPU before anyone waits for them */
+			glFlush();
+			while (!uploaded.push(r))
+				std::this_thread::yield();
+		}
+		render_worker_context_end();
+
+		info("Uploaded %i buffers, %.1f MiB in %.1f ms in the background",
+				num_uploads, num_bytes / 1048576.0, (time_seconds() - t_start) * 1e3);
+	}
+}
+
+void gl_upload_init ()
+{
+	if (render_context.sdl_worker_gl_context == nullptr) {
+		info("Uploads: on the main thread, there's no worker context");
+		return;
+	}
+	quit = false;
+	upload_thread = std::thread(upload_loop);
+}
+
+static void delete_request (upload_request_t* r)
+{
+	if (r->fence != nullptr)
+		glDeleteSync(r->fence);
+	if (r->buffer != 0)
+		gl_delete_buffer(r->buffer);
+	delete r;
+}
+
+void gl_upload_deinit ()
+{
+	if (!upload_thread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(wake_mutex);
+		quit = true;
+	}
+	wake_cond.notify_one();
+	upload_thread.join();
+
+	/* Nobody's going to take these now */
+	while (upload_request_t* r = requests.pop())
+		delete_request(r);
+	while (upload_request_t* r = uploaded.pop())
+		delete_request(r);
+	for (upload_request_t* r: in_flight)
+		delete_request(r);
+	in_flight.clear();
+}
+
+uint32_t gl_upload_submit (std::initializer_list<gl_upload_part_t> parts,
+		std::shared_ptr<const void> keep_alive)
+{
+	if (!upload_thread.joinable())
+		return 0;
+
+	upload_request_t* r = new upload_request_t { next_id++, parts, std::move(keep_alive),
+	                                              0, nullptr, { } };
+	const uint32_t id = r->id;
+	/* Only when a lot is submitted at once, the thread is on it */
+	while (!requests.push(r))
+		std::this_thread::yield();
+
+	submit_epoch.fetch_add(1);
+	if (is_sleeping.load()) {
+		std::lock_guard<std::mutex> lock(wake_mutex);
+		wake_cond.notify_one();
+	}
+	return id;
+}
+
+bool gl_upload_poll (gl_upload_done_t& done)
+{
+	while (upload_request_t* r = uploaded.pop())
+		in_flight.push_back(r);
+	if (in_flight.empty())
+		return false;
+
+	upload_request_t* r = in_flight.front();
+	const GLenum status = glClientWaitSync(r->fence, 0, 0);
+	if (status == GL_TIMEOUT_EXPIRED)
+		return false;
+	if (status == GL_WAIT_FAILED)
+		fatal("Cannot check the fence of upload %u", r->id);
+
+	in_flight.pop_front();
+	done.id = r->id;
+	done.buffer = r->buffer;
+	done.offsets = std::move(r->offsets);
+	glDeleteSync(r->fence);
+	delete r;
+	return true;
+}
@@ -0,0 +1,51 @@
+#ifndef GL_UPLOAD_H
+#define GL_UPLOAD_H
+
+#include "gl.h"
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+/*
+ * Uploads on a thread of its own, with the worker GL context, so that big
+ * buffers don't hold up a frame. What's to be uploaded goes to the thread
+ * through a lock-free queue; the thread copies it into a new staging
+ * buffer, puts a fence after that and hands the buffer back through
+ * another. The renderer polls for buffers whose fence has passed, never
+ * waiting for one, and copies them where they belong on the GPU.
+ *
+ * Without a worker context there's no thread, and whoever asked for the
+ * upload has to make it themselves
+ */
+
+/* Started by render_init(), if there's a worker context */
+void gl_upload_init ();
+void gl_upload_deinit ();
+
+struct gl_upload_part_t {
+	const void* data;
+	size_t size;
+};
+
+/*
+ * Queues the parts to be uploaded, one after another into one buffer.
+ * keep_alive owns the memory they point into, and is released as soon
+ * as they're uploaded. Returns the id of the upload, or 0 if there's no
+ * upload thread
+ */
+uint32_t gl_upload_submit (std::initializer_list<gl_upload_part_t> parts,
+		std::shared_ptr<const void> keep_alive);
+
+/* An upload the GPU is done with */
+struct gl_upload_done_t {
+	uint32_t id;
+	/* For the caller to copy from and delete */
+	GLuint buffer;
+	/* Where each of the parts is in the buffer */
+	std::vector<size_t> offsets;
+};
+
+/* In the order they were submitted, so one at a time. Never waits */
+bool gl_upload_poll (gl_upload_done_t& done);
+
+#endif /* GL_UPLOAD_H */
@@ -0,0 +1,150 @@
+#include "glsl_source.h"
+#include "mapped_file.h"
+#include "util.h"
+#include <algorithm>
+#include <cstring>
+
+const glsl_source_cache_t::file_t& glsl_source_cache_t::load (
+		const std::string& path, const std::string& root)
+{
+	file_t& f = files[path];
+	if (f.loaded)
+		return f;
+
+	mapped_file_t mapped;
+	if (!mapped.open((dir + path).c_str())) {
+		if (path == root) {
+			fatal("Shader %s: cannot open file", path.c_str());
+		} else {
+			fatal("Shader %s (included from %s): cannot open file",
+					path.c_str(), root.c_str());
+		}
+	}
+	num_reads++;
+
+	/* Every line gets a '\n', the last one too */
+	f.segments.clear();
+	f.segments.push_back({ "", "", 0 });
+	const char* p = mapped.data;
+	const char* end = mapped.data + mapped.size;
+	for (int line_nr = 1; p < end; line_nr++) {
+		const char* eol = (const char*) memchr(p, '\n', end - p);
+		if (eol == nullptr)
+			eol = end;
+
+		constexpr size_t INCLUDE_LEN = sizeof("#include ") - 1;
+		segment_t& s = f.segments.back();
+		if (eol - p >= (ptrdiff_t) INCLUDE_LEN && memcmp(p, "#include ", INCLUDE_LEN) == 0) {
+			s.include.assign(p + INCLUDE_LEN, eol);
+			s.next_line = line_nr + 1;
+			f.segments.push_back({ "", "", 0 });
+		} else {
+			s.text.append(p, eol);
+			s.text += '\n';
+		}
+		p = eol + 1;
+	}
+	f.loaded = true;
+	return f;
+}
+
+void glsl_source_cache_t::line_directive (glsl_source_t& src, int line_nr, int file_nr) const
+{
+	src.text += "#line " + std::to_string(line_nr) + ' ';
+	if (filenames_in_line_directives)
+		src.text += '\"' + src.files[file_nr - 1] + '\"';
+	else
+		src.text += std::to_string(file_nr);
+	src.text += '\n';
+}
+
+void glsl_source_cache_t::append (const std::string& path, const std::string& root,
+		int file_nr, glsl_source_t& src, int recursion_depth)
+{
+	constexpr int max_recursion_depth = 100;
+	if (recursion_depth > max_recursion_depth) {
+		fatal("Shader %s has a recursive #include chain of depth > %i. "
+		      "Note that it is NOT possible to guard #include with "
+		      "conditional compilation directives!",
+		      root.c_str(), max_recursion_depth);
+	}
+
+	const file_t& f = load(path, root);
+	for (const segment_t& s: f.segments) {
+		src.text += s.text;
+		if (s.include.empty())
+			continue;
+
+		src.files.push_back(s.include);
+		const int incl_nr = src.files.size();
+		line_directive(src, 1, incl_nr);
+		append(s.include, root, incl_nr, src, recursion_depth + 1);
+		line_directive(src, s.next_line, file_nr);
+	}
+}
+
+const glsl_source_t& glsl_source_cache_t::expand (const std::string& path)
+{
+	auto it = expanded.find(path);
+	if (it != expanded.end())
+		return it->second;
+
+	for (int i = 0; i < num_embedded; i++) {
+		const glsl_embedded_shader_t& e = embedded[i];
+		if (path == e.path)
+			return expanded[path] = { e.text, e.reported_path, { path } };
+	}
+
+	glsl_source_t src;
+	src.files = { path };
+	append(path, path, 1, src, 0);
+	num_expansions++;
+
+	/* So that errors in includes can be told apart */
+	src.reported_path = path;
+	if (!filenames_in_line_directives && src.files.size() > 1) {
+		src.reported_path += " (source strings";
+		for (size_t i = 0; i < src.files.size(); i++) {
+			src.reported_path += (i == 0 ? ": " : ", ")
+				+ std::to_string(i + 1) + " " + src.files[i];
+		}
+		src.reported_path += ")";
+	}
+
+	for (const std::string& file: src.files) {
+		std::vector<std::string>& d = dependents[file];
+		if (std::find(d.begin(), d.end(), path) == d.end())
+			d.push_back(path);
+	}
+	return expanded[path] = std::move(src);
+}
+
+std::vector<std::string> glsl_source_cache_t::invalidate (const std::string& path)
+{
+	files.erase(path);
+
+	const std::vector<std::string> roots = dependents[path];
+	for (const std::string& root: roots) {
+		/* It may not include the same files when it's expanded again */
+		for (const std::string& file: expanded[root].files) {
+			std::vector<std::string>& d = dependents[file];
+			d.erase(std::remove(d.begin(), d.end(), root), d.end());
+		}
+		expanded.erase(root);
+	}
+	return roots;
+}
+
+void glsl_source_cache_t::use_embedded (const glsl_embedded_shader_t* shaders, int num)
+{
+	clear();
+	embedded = shaders;
+	num_embedded = num;
+}
+
+void glsl_source_cache_t::clear ()
+{
+	files.clear();
+	expanded.clear();
+	dependents.clear();
+}
@@ -0,0 +1,92 @@
+#ifndef GLSL_SOURCE_H
+#define GLSL_SOURCE_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/* A shader file with its includes pasted in, ready for glShaderSource */
+struct glsl_source_t {
+	std::string text;
+	/* What to call it in errors, with the source string number of each file */
+	std::string reported_path;
+	/* Every file it was made of, itself first */
+	std::vector<std::string> files;
+};
+
+/* Expanded at build time by tools/embed_shaders.cpp, into a generated file */
+struct glsl_embedded_shader_t {
+	const char* path;
+	const char* text;
+	const char* reported_path;
+};
+extern const glsl_embedded_shader_t glsl_embedded_shaders[];
+extern const int glsl_num_embedded_shaders;
+
+/*
+ * Shader sources, without anything GL. Each file is read once and split
+ * at its #include lines, and the expansion of each file that was asked
+ * for is kept until one of the files it's made of changes.
+ *
+ * In the expansion, #line directives give every file its own source
+ * string number: 0 is the prologue, 1 the file itself, and includes go
+ * on from there in the order they appear. An #include line is the whole
+ * line, "#include file", with the path relative to `dir`
+ */
+struct glsl_source_cache_t {
+	std::string dir;
+	/* Otherwise source string numbers, which is all that GLSL has without extensions */
+	bool filenames_in_line_directives;
+
+	explicit glsl_source_cache_t (std::string shader_dir, bool with_filenames = false)
+		: dir(std::move(shader_dir)), filenames_in_line_directives(with_filenames) { }
+
+	/* Fatal if any of the files can't be read */
+	const glsl_source_t& expand (const std::string& path);
+
+	/*
+	 * Expanded files are then taken from there rather than read, and
+	 * others are still read. They depend on nothing, as they don't change
+	 */
+	void use_embedded (const glsl_embedded_shader_t* shaders, int num);
+
+	/*
+	 * The file is read again when it's next needed. Returns the files
+	 * that were expanded before and include it, itself among them
+	 */
+	std::vector<std::string> invalidate (const std::string& path);
+	void clear ();
+
+	/* Of all reads and expansions, for reports */
+	uint32_t num_reads = 0;
+	uint32_t num_expansions = 0;
+
+private:
+	/* Lines up to an #include, or the end of the file */
+	struct segment_t {
+		std::string text;
+		/* Empty in the last segment */
+		std::string include;
+		/* Of the line after the #include */
+		int next_line;
+	};
+	struct file_t {
+		std::vector<segment_t> segments;
+		bool loaded = false;
+	};
+
+	std::unordered_map<std::string, file_t> files;
+	std::unordered_map<std::string, glsl_source_t> expanded;
+	/* For each file, those expanded ones that include it */
+	std::unordered_map<std::string, std::vector<std::string>> dependents;
+	const glsl_embedded_shader_t* embedded = nullptr;
+	int num_embedded = 0;
+
+	const file_t& load (const std::string& path, const std::string& root);
+	void append (const std::string& path, const std::string& root, int file_nr,
+			glsl_source_t& src, int recursion_depth);
+	void line_directive (glsl_source_t& src, int line_nr, int file_nr) const;
+};
+
+#endif /* GLSL_SOURCE_H */
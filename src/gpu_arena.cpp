@@ -0,0 +1,292 @@
+#include "gpu_arena.h"
+#include "util.h"
+#include <algorithm>
+#include <cassert>
+
+/* ================ RANGE ALLOCATOR ================ */
+
+static int floor_log2 (uint32_t x)
+{
+	return 31 - __builtin_clz(x);
+}
+
+/* The size class that a free block of this size goes into */
+void range_allocator_t::size_class (uint32_t size, int& fl, int& sl)
+{
+	if (size < (1u << SL_BITS)) {
+		/* Small sizes get a class each */
+		fl = 0;
+		sl = size;
+	} else {
+		const int log = floor_log2(size);
+		fl = log - SL_BITS + 1;
+		sl = (size >> (log - SL_BITS)) - (1u << SL_BITS);
+	}
+}
+
+uint32_t range_allocator_t::new_block (uint32_t offset, uint32_t size)
+{
+	uint32_t b;
+	if (!spare_blocks.empty()) {
+		b = spare_blocks.back();
+		spare_blocks.pop_back();
+	} else {
+		b = blocks.size();
+		blocks.emplace_back();
+	}
+	blocks[b] = { offset, size, NONE, NONE, NONE, NONE, false };
+	return b;
+}
+
+void range_allocator_t::insert_free (uint32_t b)
+{
+	int fl, sl;
+	size_class(blocks[b].size, fl, sl);
+
+	const uint32_t head = free_heads[fl][sl];
+	blocks[b].is_free = true;
+	blocks[b].prev_free = NONE;
+	blocks[b].next_free = head;
+	if (head != NONE)
+		blocks[head].prev_free = b;
+	free_heads[fl][sl] = b;
+
+	fl_bitmap |= 1u << fl;
+	sl_bitmap[fl] |= 1u << sl;
+	num_free_blocks++;
+}
+
+void range_allocator_t::remove_free (uint32_t b)
+{
+	int fl, sl;
+	size_class(blocks[b].size, fl, sl);
+
+	const uint32_t prev = blocks[b].prev_free;
+	const uint32_t next = blocks[b].next_free;
+	if (prev != NONE)
+		blocks[prev].next_free = next;
+	else
+		free_heads[fl][sl] = next;
+	if (next != NONE)
+		blocks[next].prev_free = prev;
+
+	if (free_heads[fl][sl] == NONE) {
+		sl_bitmap[fl] &= ~(1u << sl);
+		if (sl_bitmap[fl] == 0)
+			fl_bitmap &= ~(1u << fl);
+	}
+	blocks[b].is_free = false;
+	num_free_blocks--;
+}
+
+/* `next` is right after `into` in the address space */
+uint32_t range_allocator_t::merge (uint32_t into, uint32_t next)
+{
+	blocks[into].size += blocks[next].size;
+	const uint32_t after = blocks[next].next_phys;
+	blocks[into].next_phys = after;
+	if (after != NONE)
+		blocks[after].prev_phys = into;
+	else
+		last_block = into;
+	spare_blocks.push_back(next);
+	return into;
+}
+
+void range_allocator_t::init (uint32_t initial_capacity)
+{
+	blocks.clear();
+	spare_blocks.clear();
+	fl_bitmap = 0;
+	for (int fl = 0; fl < FL_COUNT; fl++) {
+		sl_bitmap[fl] = 0;
+		for (int sl = 0; sl < SL_COUNT; sl++)
+			free_heads[fl][sl] = NONE;
+	}
+
+	capacity = 0;
+	used = 0;
+	num_allocations = 0;
+	num_free_blocks = 0;
+	last_block = NONE;
+	grow(initial_capacity);
+}
+
+uint32_t range_allocator_t::alloc (uint32_t size)
+{
+	size = std::max(size, 1u);
+
+	/*
+	 * Look from the class above the one the size falls into, where every
+	 * block is big enough, so that the first block found will do
+	 */
+	uint64_t search_size = size;
+	if (size >= SL_COUNT)
+		search_size += (1u << (floor_log2(size) - SL_BITS)) - 1;
+	if (search_size > capacity)
+		return NONE;
+
+	int fl, sl;
+	size_class(search_size, fl, sl);
+
+	uint32_t sl_map = sl_bitmap[fl] & (~0u << sl);
+	if (sl_map == 0) {
+		const uint32_t fl_map = fl + 1 < FL_COUNT ? fl_bitmap & (~0u << (fl + 1)) : 0;
+		if (fl_map == 0)
+			return NONE;
+		fl = __builtin_ctz(fl_map);
+		sl_map = sl_bitmap[fl];
+	}
+	sl = __builtin_ctz(sl_map);
+
+	const uint32_t b = free_heads[fl][sl];
+	remove_free(b);
+
+	/* The rest goes back as a free block of its own */
+	if (blocks[b].size > size) {
+		const uint32_t rest = new_block(blocks[b].offset + size, blocks[b].size - size);
+		const uint32_t after = blocks[b].next_phys;
+		blocks[rest].prev_phys = b;
+		blocks[rest].next_phys = after;
+		if (after != NONE)
+			blocks[after].prev_phys = rest;
+		else
+			last_block = rest;
+		blocks[b].next_phys = rest;
+		blocks[b].size = size;
+		insert_free(rest);
+	}
+
+	used += size;
+	num_allocations++;
+	return b;
+}
+
+void range_allocator_t::free (uint32_t b)
+{
+	assert(!blocks[b].is_free);
+	used -= blocks[b].size;
+	num_allocations--;
+
+	const uint32_t prev = blocks[b].prev_phys;
+	if (prev != NONE && blocks[prev].is_free) {
+		remove_free(prev);
+		b = merge(prev, b);
+	}
+	const uint32_t next = blocks[b].next_phys;
+	if (next != NONE && blocks[next].is_free) {
+		remove_free(next);
+		b = merge(b, next);
+	}
+	insert_free(b);
+}
+
+void range_allocator_t::grow (uint32_t new_capacity)
+{
+	assert(new_capacity >= capacity);
+	const uint32_t added = new_capacity - capacity;
+	if (added == 0)
+		return;
+
+	if (last_block != NONE && blocks[last_block].is_free) {
+		remove_free(last_block);
+		blocks[last_block].size += added;
+		insert_free(last_block);
+	} else {
+		const uint32_t b = new_block(capacity, added);
+		blocks[b].prev_phys = last_block;
+		if (last_block != NONE)
+			blocks[last_block].next_phys = b;
+		last_block = b;
+		insert_free(b);
+	}
+	capacity = new_capacity;
+}
+
+uint32_t range_allocator_t::largest_free () const
+{
+	if (fl_bitmap == 0)
+		return 0;
+
+	/* It's in the highest class there is, which isn't sorted any further */
+	const int fl = floor_log2(fl_bitmap);
+	const int sl = floor_log2(sl_bitmap[fl]);
+	uint32_t largest = 0;
+	for (uint32_t b = free_heads[fl][sl]; b != NONE; b = blocks[b].next_free)
+		largest = std::max(largest, blocks[b].size);
+	return largest;
+}
+
+/* ================ GPU ARENA ================ */
+
+void gpu_arena_t::init (size_t unit_size, uint32_t capacity_units)
+{
+	unit = unit_size;
+	generation = 0;
+	ranges.init(capacity_units);
+
+	buffer = gl_gen_buffer();
+	gl_bind_buffer(GL_COPY_WRITE_BUFFER, buffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, capacity_units * unit, nullptr, GL_STATIC_DRAW);
+}
+
+void gpu_arena_t::deinit ()
+{
+	gl_delete_buffer(buffer);
+}
+
+uint32_t gpu_arena_t::alloc (size_t bytes)
+{
+	const uint32_t units = (bytes + unit - 1) / unit;
+
+	uint32_t handle = ranges.alloc(units);
+	while (handle == range_allocator_t::NONE) {
+		const uint32_t old_capacity = ranges.capacity;
+		const uint32_t new_capacity = std::max(old_capacity * 2, old_capacity + units);
+
+		GLuint grown = gl_gen_buffer();
+		gl_bind_buffer(GL_COPY_READ_BUFFER, buffer);
+		gl_bind_buffer(GL_COPY_WRITE_BUFFER, grown);
+		glBufferData(GL_COPY_WRITE_BUFFER, new_capacity * unit, nullptr, GL_STATIC_DRAW);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+				0, 0, old_capacity * unit);
+		gl_delete_buffer(buffer);
+		buffer = grown;
+		generation++;
+
+		ranges.grow(new_capacity);
+		info("GPU arena grew to %.1f MiB", new_capacity * unit / 1048576.0);
+		handle = ranges.alloc(units);
+	}
+	return handle;
+}
+
+void gpu_arena_t::free (uint32_t handle)
+{
+	ranges.free(handle);
+}
+
+void gpu_arena_t::upload (uint32_t handle, const void* data, size_t bytes)
+{
+	assert(bytes <= ranges.size(handle) * unit);
+	gl_bind_buffer(GL_COPY_WRITE_BUFFER, buffer);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, offset_bytes(handle), bytes, data);
+}
+
+void gpu_arena_t::copy (uint32_t handle, GLuint src, size_t src_offset, size_t bytes)
+{
+	assert(bytes <= ranges.size(handle) * unit);
+	gl_bind_buffer(GL_COPY_READ_BUFFER, src);
+	gl_bind_buffer(GL_COPY_WRITE_BUFFER, buffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+			src_offset, offset_bytes(handle), bytes);
+}
+
+gpu_arena_stats_t gpu_arena_t::stats () const
+{
+	return { ranges.capacity * unit,
+	         ranges.used * unit,
+	         ranges.largest_free() * unit,
+	         ranges.num_allocations,
+	         ranges.num_free_blocks };
+}
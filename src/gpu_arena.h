@@ -0,0 +1,100 @@
+#ifndef GPU_ARENA_H
+#define GPU_ARENA_H
+
+#include "gl.h"
+#include <cstdint>
+#include <vector>
+
+/*
+ * Two-level segregated fit allocator (TLSF) of ranges in [0, capacity),
+ * in whatever units. Free ranges are kept in lists by size class: the
+ * first level is the power of two, the second splits that into 16.
+ * Allocating and freeing take constant time, and freed ranges are merged
+ * with their free neighbours right away.
+ */
+struct range_allocator_t {
+	static constexpr uint32_t NONE = ~uint32_t{0};
+
+	void init (uint32_t capacity);
+
+	/* A handle to the range, or NONE if no free range is big enough */
+	uint32_t alloc (uint32_t size);
+	void free (uint32_t handle);
+	uint32_t offset (uint32_t handle) const { return blocks[handle].offset; }
+	uint32_t size (uint32_t handle) const { return blocks[handle].size; }
+
+	/* Adds free space at the end */
+	void grow (uint32_t new_capacity);
+
+	uint32_t capacity;
+	uint32_t used;
+	uint32_t num_allocations;
+	uint32_t num_free_blocks;
+	uint32_t largest_free () const;
+
+private:
+	static constexpr int SL_BITS = 4;
+	static constexpr int SL_COUNT = 1 << SL_BITS;
+	static constexpr int FL_COUNT = 32;
+
+	struct block_t {
+		uint32_t offset;
+		uint32_t size;
+		/* Neighbours in the address space, and in the free list */
+		uint32_t prev_phys, next_phys;
+		uint32_t prev_free, next_free;
+		bool is_free;
+	};
+
+	std::vector<block_t> blocks;
+	/* Records in `blocks` that aren't used, to be reused */
+	std::vector<uint32_t> spare_blocks;
+	uint32_t last_block;
+
+	uint32_t fl_bitmap;
+	uint16_t sl_bitmap[FL_COUNT];
+	uint32_t free_heads[FL_COUNT][SL_COUNT];
+
+	static void size_class (uint32_t size, int& fl, int& sl);
+	uint32_t new_block (uint32_t offset, uint32_t size);
+	void insert_free (uint32_t b);
+	void remove_free (uint32_t b);
+	uint32_t merge (uint32_t into, uint32_t next);
+};
+
+/* Byte sizes and counts of an arena, for showing */
+struct gpu_arena_stats_t {
+	size_t capacity;
+	size_t used;
+	size_t largest_free;
+	uint32_t num_allocations;
+	uint32_t num_free_blocks;
+};
+
+/*
+ * A big GL buffer with ranges of it handed out by a range_allocator_t,
+ * in units of `unit` bytes. When it's full it grows: the contents are
+ * copied into a buffer twice the size, so offsets stay valid, but the
+ * buffer name changes and anything referring to it has to be told
+ */
+struct gpu_arena_t {
+	GLuint buffer;
+	size_t unit;
+	range_allocator_t ranges;
+	/* Bumped whenever `buffer` changes */
+	uint32_t generation;
+
+	void init (size_t unit_size, uint32_t capacity_units);
+	void deinit ();
+
+	uint32_t alloc (size_t bytes);
+	void free (uint32_t handle);
+	size_t offset_bytes (uint32_t handle) const { return ranges.offset(handle) * unit; }
+	void upload (uint32_t handle, const void* data, size_t bytes);
+	/* On the GPU, from src_offset bytes into another buffer */
+	void copy (uint32_t handle, GLuint src, size_t src_offset, size_t bytes);
+
+	gpu_arena_stats_t stats () const;
+};
+
+#endif /* GPU_ARENA_H */
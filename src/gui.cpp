@@ -1,6 +1,10 @@
 #include "util.h"
 #include "input.h"
 #include "gui.h"
+#include "gl_glsl.h"
+#include "mesh.h"
+#include "render_thread.h"
+#include "scene.h"
 #include "imgui/imgui.h"
 #include "imgui/imgui_impl_opengl3.h"
 #include "imgui/imgui_impl_sdl.h"
@@ -12,6 +16,7 @@ static ImFont* im_font;
 static ImGuiContext* im_context;
 
 float app_font_scale = 16.0;
+scene_settings_t gui_scene_settings;
 static int gui_frame_number = 0;
 
 static bool show_imgui_demo_window = false;
@@ -48,6 +53,12 @@ void gui_init ()
 	                                    nullptr,
 	                                    atlas->GetGlyphRangesCyrillic());
 	assert(im_font != nullptr);
+
+	/*
+	 * Makes the font texture and such now, while the context is current
+	 * on this thread, rather than on the first frame drawn
+	 */
+	ImGui_ImplOpenGL3_NewFrame();
 }
 
 void gui_deinit ()
@@ -63,7 +74,6 @@ void gui_generate_frame ()
 {
 	gui_frame_number++;
 
-	ImGui_ImplOpenGL3_NewFrame();
 	ImGui_ImplSDL2_NewFrame(render_context.sdl_window);
 	ImGui::NewFrame();
 
@@ -95,12 +105,39 @@ void gui_generate_frame ()
 	ImGui::Render();
 }
 
-void gui_render_frame ()
+void gui_copy_draw_data (gui_draw_data_t& copy)
+{
+	for (ImDrawList* list: copy.lists)
+		IM_DELETE(list);
+	copy.lists.clear();
+
+	const ImDrawData* src = ImGui::GetDrawData();
+	if (copy.data == nullptr)
+		copy.data = IM_NEW(ImDrawData)();
+	*copy.data = *src;
+	for (int i = 0; i < src->CmdListsCount; i++)
+		copy.lists.push_back(src->CmdLists[i]->CloneOutput());
+	copy.data->CmdLists = copy.lists.data();
+}
+
+void gui_free_draw_data (gui_draw_data_t& copy)
+{
+	for (ImDrawList* list: copy.lists)
+		IM_DELETE(list);
+	copy.lists.clear();
+	if (copy.data != nullptr)
+		IM_DELETE(copy.data);
+	copy.data = nullptr;
+}
+
+void gui_render_frame (const gui_draw_data_t& draw_data, int resolution_x, int resolution_y)
 {
 	assert(render_context.is_rendering);
 
-	glViewport(0, 0, render_context.resolution_x, render_context.resolution_y);
-	ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+	gl_viewport(0, 0, resolution_x, resolution_y);
+	ImGui_ImplOpenGL3_RenderDrawData(draw_data.data);
+	/* It set state without the cache knowing */
+	gl_state_invalidate();
 }
 
 void gui_handle_event (SDL_Event& e)
@@ -175,11 +212,77 @@ static void gui_generate_viewport2d ()
 	End();
 }
 
+/* Fragmentation is how much of the free space isn't in the largest free block */
+static void gui_arena_stats (const char* name, const gpu_arena_stats_t& st)
+{
+	constexpr double MIB = 1 << 20;
+	const size_t free_bytes = st.capacity - st.used;
+	const double utilization = st.capacity ? (double) st.used / st.capacity : 0.0;
+	const double fragmentation = free_bytes ? 1.0 - (double) st.largest_free / free_bytes : 0.0;
+
+	Text("%-8s %7.2f / %7.2f MiB (%3.0f%% used), %u ranges, "
+	     "%u free blocks, %3.0f%% fragmented",
+	     name, st.used / MIB, st.capacity / MIB, utilization * 100.0,
+	     st.num_allocations, st.num_free_blocks, fragmentation * 100.0);
+}
+
 static void gui_generate_bottom_window ()
 {
 	SetNextWindowPos(gui_bottom_window_pos);
 	SetNextWindowSize(gui_bottom_window_size);
 	Begin("##bottom", nullptr, RIGID_WINDOW_FLAGS);
 
+	/* Of the last frame drawn, which may be one behind the one being made */
+	const render_stats_t& stats = render_stats;
+	if (CollapsingHeader("Frame", ImGuiTreeNodeFlags_DefaultOpen)) {
+		const frame_timings_t& t = stats.timings;
+		Text("Main thread %6.2f ms, %6.2f ms waiting; render thread %6.2f ms, "
+		     "%6.2f ms waiting",
+		     t.main_ms, t.main_wait_ms, t.render_ms, t.render_wait_ms);
+	}
+	if (CollapsingHeader("Mesh arena", ImGuiTreeNodeFlags_DefaultOpen)) {
+		const mesh_arena_stats_t& st = stats.mesh_arena;
+		gui_arena_stats("Vertices", st.vertices);
+		gui_arena_stats("Indices", st.indices);
+	}
+	if (CollapsingHeader("GL state", ImGuiTreeNodeFlags_DefaultOpen)) {
+		const gl_state_counters_t& c = stats.gl_state;
+		Text("Last frame: %u state changes issued, %u redundant ones filtered",
+		     c.issued, c.filtered);
+	}
+	if (CollapsingHeader("Shaders", ImGuiTreeNodeFlags_DefaultOpen)) {
+		const glsl_reload_status_t& st = stats.shader_reload;
+		Text("%u programs reloaded, %u reloads failed", st.num_reloaded, st.num_failed);
+		if (!st.log.empty())
+			TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", st.log.c_str());
+	}
+	if (CollapsingHeader("Scene", ImGuiTreeNodeFlags_DefaultOpen)) {
+		scene_settings_t& settings = gui_scene_settings;
+		Checkbox("Frustum culling", &settings.culling);
+		SameLine();
+		Text("%u of %zu objects drawn,", stats.scene_num_drawn, scene_objects.size());
+		Checkbox("Occlusion culling", &settings.occlusion_culling);
+		if (settings.occlusion_culling) {
+			const occlusion_stats_t& st = stats.occlusion;
+			SameLine();
+			Text("%u occluders (%u triangles), %u of %u culled, "
+			     "%.2f ms rendering, %.2f ms testing",
+			     st.num_occluders, st.num_triangles, st.num_culled, st.num_tested,
+			     st.render_ms, st.test_ms);
+		}
+		const struct { scene_draw_mode_t mode; const char* name; } modes[] = {
+			{ SCENE_DRAW_PER_OBJECT, "a draw per object" },
+			{ SCENE_DRAW_INSTANCED, "instanced" },
+			{ SCENE_DRAW_MULTI, "multi-draw indirect" },
+		};
+		for (const auto& m: modes) {
+			if (!scene_draw_mode_supported(m.mode))
+				continue;
+			SameLine();
+			if (RadioButton(m.name, settings.draw_mode == m.mode))
+				settings.draw_mode = m.mode;
+		}
+	}
+
 	End();
 }
@@ -2,6 +2,11 @@
 #define GUI_H
 
 #include "gl.h"
+#include "scene.h"
+#include <vector>
+
+struct ImDrawData;
+struct ImDrawList;
 
 extern float app_font_scale;
 
@@ -19,7 +24,22 @@ extern vec2 gui_viewport2d_pos, gui_viewport2d_size;
  */
 void gui_generate_frame ();
 
+/* What the GUI changes about the scene, recorded into each frame */
+extern scene_settings_t gui_scene_settings;
+
+/*
+ * A copy of what ImGui made for a frame, that stays as it is while the
+ * next frame is generated
+ */
+struct gui_draw_data_t {
+	ImDrawData* data = nullptr;
+	std::vector<ImDrawList*> lists;
+};
+/* Of the last gui_generate_frame, over what the copy had before */
+void gui_copy_draw_data (gui_draw_data_t& copy);
+void gui_free_draw_data (gui_draw_data_t& copy);
+
 /* Makes the drawcalls for GUI */
-void gui_render_frame ();
+void gui_render_frame (const gui_draw_data_t& draw_data, int resolution_x, int resolution_y);
 
 #endif /* GUI_H */
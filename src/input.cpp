@@ -1,8 +1,12 @@
 #include "app.h"
+#include "bench.h"
 #include "gl.h"
 #include "gui.h"
 #include "imgui/imgui.h"
 #include "input.h"
+#include "job.h"
+#include "mesh_optimize.h"
+#include "render_thread.h"
 #include "util.h"
 #include <map>
 
@@ -163,6 +167,7 @@ enum cmdline_flag_type_t {
 	BOOL_FALSE,
 	INT_VAL,
 	FLOAT_VAL,
+	STRING_VAL,
 };
 
 struct cmdline_flag_t {
@@ -174,7 +179,15 @@ struct cmdline_flag_t {
 const static cmdline_flag_t cmdline_flags[] = {
 	{ "opengl-debug", BOOL_TRUE, &app_opengl_debug },
 	{ "opengl-msaa", INT_VAL, &app_opengl_msaa },
+	{ "no-multi-draw-indirect", BOOL_FALSE, &app_multi_draw_indirect },
+	{ "shaders-from-disk", BOOL_TRUE, &app_shaders_from_disk },
+	{ "no-shader-hot-reload", BOOL_FALSE, &app_shader_hot_reload },
+	{ "no-render-thread", BOOL_FALSE, &app_render_thread },
+	{ "threads", INT_VAL, &app_num_threads },
 	{ "font-scale", FLOAT_VAL, &app_font_scale },
+	{ "mesh-optimize", STRING_VAL, &app_mesh_optimize },
+	{ "benchmark", STRING_VAL, &app_benchmark },
+	{ "benchmark-size", INT_VAL, &app_benchmark_size },
 };
 
 constexpr int cmdline_flag_nr = sizeof(cmdline_flags) / sizeof(cmdline_flag_t);
@@ -210,6 +223,13 @@ static void set_cmdline_flag (const cmdline_flag_t& f, const char* value)
 					f.name);
 		}
 		*((float*) f.variable) = atoi(value);
+		break;
+	case STRING_VAL:
+		if (value == nullptr)
+			fatal("Option --%s requires an argument", f.name);
+		/* Points into argv, which outlives everything */
+		*((const char**) f.variable) = value;
+		break;
 	}
 }
 
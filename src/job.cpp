@@ -0,0 +1,487 @@
+#include "job.h"
+#include "util.h"
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/* Threads are as much a resource as memory, more than this is a typo */
+static constexpr int MAX_THREADS = 256;
+/* Default parallel_for pieces per thread, so that a slow one doesn't stall */
+static constexpr int GRAINS_PER_THREAD = 8;
+/* Before an idle worker goes to sleep, in case another job is about to come */
+static constexpr int SPINS_BEFORE_SLEEP = 2000;
+/* Before a waiting thread yields its core instead of spinning */
+static constexpr int SPINS_BEFORE_YIELD = 100;
+
+int app_num_threads = 0;
+
+static inline void cpu_relax ()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	_mm_pause();
+#elif defined(__aarch64__)
+	asm volatile ("yield");
+#endif
+}
+
+/* A task, or else a piece of a parallel_for */
+struct job_t {
+	std::function<void ()> task;
+	job_range_func_t range_func;
+	void* context;
+	int begin;
+	int end;
+	int grain;
+	job_counter_t* counter;
+};
+
+/* ================ DEQUE ================ */
+
+/*
+ * Chase-Lev, with the memory orders of "Correct and Efficient
+ * Work-Stealing for Weak Memory Models" (Lê et al.), but a fixed capacity:
+ * a job that doesn't fit is run right away instead. The owner pushes and
+ * pops at the bottom, anybody may steal at the top
+ */
+struct job_deque_t {
+	static constexpr int64_t CAPACITY = 1024;
+
+	alignas(64) std::atomic<int64_t> top = 0;
+	alignas(64) std::atomic<int64_t> bottom = 0;
+	alignas(64) std::atomic<job_t*> slots[CAPACITY];
+
+	bool push (job_t* job);
+	job_t* pop ();
+	job_t* steal ();
+	/* Only a guess, unless by the owner */
+	bool empty () const;
+};
+
+bool job_deque_t::push (job_t* job)
+{
+	const int64_t b = bottom.load(std::memory_order_relaxed);
+	const int64_t t = top.load(std::memory_order_acquire);
+	if (b - t >= CAPACITY)
+		return false;
+
+	slots[b % CAPACITY].store(job, std::memory_order_relaxed);
+	/* Publishes the job along with it, to thieves that acquire bottom */
+	bottom.store(b + 1, std::memory_order_release);
+	return true;
+}
+
+job_t* job_deque_t::pop ()
+{
+	const int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+	bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t t = top.load(std::memory_order_relaxed);
+
+	if (t > b) {
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	job_t* job = slots[b % CAPACITY].load(std::memory_order_relaxed);
+	if (t == b) {
+		/* The last one, a thief may be after it too */
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+		                                 std::memory_order_relaxed))
+			job = nullptr;
+		bottom.store(b + 1, std::memory_order_relaxed);
+	}
+	return job;
+}
+
+job_t* job_deque_t::steal ()
+{
+	while (true) {
+		int64_t t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		const int64_t b = bottom.load(std::memory_order_acquire);
+		if (t >= b)
+			return nullptr;
+
+		job_t* job = slots[t % CAPACITY].load(std::memory_order_relaxed);
+		if (top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+		                                std::memory_order_relaxed))
+			return job;
+		/* Another thief or the owner got it, there may be more */
+	}
+}
+
+bool job_deque_t::empty () const
+{
+	return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+}
+
+/* ================ SCHEDULER ================ */
+
+/*
+ * What workers use is never destroyed: fatal() exits without stopping
+ * them, and destroying a condition variable they sleep on would hang
+ */
+
+/* [0] is of the thread that started the system, then one per worker */
+static auto& deques = *new std::vector<std::unique_ptr<job_deque_t>>;
+static auto& workers = *new std::vector<std::thread>;
+
+/* Of the threads that have no deque */
+static std::mutex shared_mutex;
+static auto& shared_jobs = *new std::deque<job_t*>;
+static std::atomic<int> num_shared_jobs;
+
+/* Bumped on every new job, so that a worker about to sleep notices it */
+static std::atomic<uint32_t> work_epoch;
+static std::atomic<int> num_sleeping;
+static std::mutex sleep_mutex;
+static auto& sleep_cond = *new std::condition_variable;
+/* Set under sleep_mutex */
+static std::atomic<bool> quit;
+
+/* Into deques, -1 for threads that have none */
+static thread_local int thread_index = -1;
+/* Where stealing starts, so that thieves don't all go for the same deque */
+static thread_local uint32_t steal_start;
+
+static void wake_worker ()
+{
+	work_epoch.fetch_add(1);
+	if (num_sleeping.load() > 0) {
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		sleep_cond.notify_one();
+	}
+}
+
+/* False if there's no room, then it's for the caller to run */
+static bool push_job (job_t* job)
+{
+	if (thread_index >= 0) {
+		if (!deques[thread_index]->push(job))
+			return false;
+	} else {
+		std::lock_guard<std::mutex> lock(shared_mutex);
+		shared_jobs.push_back(job);
+		num_shared_jobs++;
+	}
+	wake_worker();
+	return true;
+}
+
+/* Whether this thread has jobs waiting that others could take */
+static bool has_queued_jobs ()
+{
+	if (thread_index >= 0)
+		return !deques[thread_index]->empty();
+	return num_shared_jobs.load(std::memory_order_relaxed) > 0;
+}
+
+/* This thread's own newest job first, then the oldest of anyone else's */
+static job_t* find_job ()
+{
+	if (thread_index >= 0) {
+		if (job_t* job = deques[thread_index]->pop())
+			return job;
+	}
+
+	if (num_shared_jobs.load(std::memory_order_relaxed) > 0) {
+		std::lock_guard<std::mutex> lock(shared_mutex);
+		if (!shared_jobs.empty()) {
+			job_t* job = shared_jobs.front();
+			shared_jobs.pop_front();
+			num_shared_jobs--;
+			return job;
+		}
+	}
+
+	const int n = deques.size();
+	const uint32_t start = steal_start++;
+	for (int i = 0; i < n; i++) {
+		const int victim = (start + i) % n;
+		if (victim == thread_index)
+			continue;
+		if (job_t* job = deques[victim]->steal())
+			return job;
+	}
+	return nullptr;
+}
+
+static void run_range (job_range_func_t func, void* context,
+		int begin, int end, int grain, job_counter_t& counter)
+{
+	while (begin < end) {
+		/* Lazy splitting: only when idle threads may be looking for work */
+		if (end - begin >= 2 * grain && !has_queued_jobs()) {
+			const int mid = begin + (end - begin) / 2;
+			job_t* half = new job_t { { }, func, context, mid, end, grain, &counter };
+			counter.pending.fetch_add(1, std::memory_order_relaxed);
+			if (push_job(half)) {
+				end = mid;
+				continue;
+			}
+			counter.pending.fetch_sub(1, std::memory_order_relaxed);
+			delete half;
+		}
+
+		const int piece_end = std::min(end, begin + grain);
+		func(context, begin, piece_end);
+		begin = piece_end;
+	}
+}
+
+static void run_job (job_t* job)
+{
+	if (job->range_func != nullptr)
+		run_range(job->range_func, job->context, job->begin, job->end,
+				job->grain, *job->counter);
+	else
+		job->task();
+
+	/* The waiter may be gone as soon as this is decremented */
+	job_counter_t* counter = job->counter;
+	delete job;
+	counter->pending.fetch_sub(1, std::memory_order_release);
+}
+
+static void worker_loop (int index)
+{
+	thread_index = index;
+	steal_start = index;
+
+	while (!quit.load(std::memory_order_relaxed)) {
+		const uint32_t epoch = work_epoch.load();
+		if (job_t* job = find_job()) {
+			run_job(job);
+			continue;
+		}
+
+		int spins = 0;
+		while (spins < SPINS_BEFORE_SLEEP
+		    && work_epoch.load(std::memory_order_relaxed) == epoch) {
+			cpu_relax();
+			spins++;
+		}
+		if (spins < SPINS_BEFORE_SLEEP)
+			continue;
+
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		num_sleeping++;
+		sleep_cond.wait(lock, [epoch] { return work_epoch.load() != epoch || quit.load(); });
+		num_sleeping--;
+	}
+}
+
+void job_system_init (int num_threads)
+{
+	job_system_deinit();
+
+	if (num_threads <= 0)
+		num_threads = std::max(1u, std::thread::hardware_concurrency());
+	if (num_threads > MAX_THREADS) {
+		warning("%i threads are too many, using %i", num_threads, MAX_THREADS);
+		num_threads = MAX_THREADS;
+	}
+
+	for (int i = 0; i < num_threads; i++)
+		deques.push_back(std::make_unique<job_deque_t>());
+	thread_index = 0;
+	quit = false;
+	for (int i = 1; i < num_threads; i++)
+		workers.emplace_back(worker_loop, i);
+}
+
+void job_system_deinit ()
+{
+	if (deques.empty())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		quit = true;
+		work_epoch++;
+	}
+	sleep_cond.notify_all();
+	for (std::thread& t: workers)
+		t.join();
+
+	workers.clear();
+	deques.clear();
+	thread_index = -1;
+}
+
+int job_num_threads ()
+{
+	return std::max<int>(1, deques.size());
+}
+
+void job_for_each_thread_count (const std::function<void (int num_threads)>& func)
+{
+	const int max_threads = std::max(1u, std::thread::hardware_concurrency());
+	for (int threads = 1; ; threads = std::min(threads * 2, max_threads)) {
+		job_system_init(threads);
+		func(threads);
+		if (threads == max_threads)
+			break;
+	}
+	job_system_init(app_num_threads);
+}
+
+void job_run (job_counter_t& counter, std::function<void ()> task)
+{
+	if (job_num_threads() == 1) {
+		task();
+		return;
+	}
+
+	counter.pending.fetch_add(1, std::memory_order_relaxed);
+	job_t* job = new job_t { std::move(task), nullptr, nullptr, 0, 0, 0, &counter };
+	if (!push_job(job))
+		run_job(job);
+}
+
+void job_wait (job_counter_t& counter)
+{
+	int spins = 0;
+	while (counter.pending.load(std::memory_order_acquire) > 0) {
+		if (job_t* job = find_job()) {
+			run_job(job);
+			spins = 0;
+		} else if (++spins < SPINS_BEFORE_YIELD) {
+			cpu_relax();
+		} else {
+			std::this_thread::yield();
+		}
+	}
+}
+
+void job_parallel_for (int begin, int end, int grain,
+		job_range_func_t func, void* context)
+{
+	if (begin >= end)
+		return;
+	const int num_threads = job_num_threads();
+	if (num_threads == 1) {
+		func(context, begin, end);
+		return;
+	}
+
+	if (grain <= 0)
+		grain = std::max(1, (end - begin) / (num_threads * GRAINS_PER_THREAD));
+	job_counter_t counter;
+	run_range(func, context, begin, end, grain, counter);
+	job_wait(counter);
+}
+
+/* ================ BENCHMARK ================ */
+
+/* Something for each item to chew on, that the compiler can't skip */
+static float busy_work (int i, int iterations)
+{
+	float x = i;
+	for (int k = 0; k < iterations; k++)
+		x = sqrtf(x * 1.0001f + 1.0f);
+	return x;
+}
+
+static double checksum (const std::vector<float>& v)
+{
+	double sum = 0.0;
+	for (float x: v)
+		sum += x;
+	return sum;
+}
+
+void job_benchmark (int size)
+{
+	static constexpr int NUM_RUNS = 5;
+	static constexpr int ITERATIONS = 32;
+	static constexpr int NUM_OUTER = 64;
+
+	const int num_cores = std::max(1u, std::thread::hardware_concurrency());
+	const int num_spawned = std::max(1, size / 16);
+	printf("jobs: %i items, %i spawned jobs, %i cores\n", size, num_spawned, num_cores);
+	printf("  %-8s %12s %12s %12s %12s\n",
+			"threads", "spawn ns/job", "uniform ms", "uneven ms", "nested ms");
+
+	std::vector<float> out(size);
+	double reference[3] = { };
+	double uniform_1 = 0.0;
+
+	auto best_of = [&out] (auto&& func) {
+		double best = 1e30;
+		for (int run = 0; run < NUM_RUNS; run++) {
+			std::fill(out.begin(), out.end(), 0.0f);
+			const double t = time_seconds();
+			func();
+			best = std::min(best, time_seconds() - t);
+		}
+		return best;
+	};
+
+	for (int threads = 1; threads <= 64; threads *= 2) {
+		job_system_init(threads);
+
+		/* Many tiny jobs, one at a time from this thread */
+		const double spawn = best_of([&] () {
+			job_counter_t counter;
+			for (int i = 0; i < num_spawned; i++)
+				job_run(counter, [&out, i] () { out[i] = i; });
+			job_wait(counter);
+		});
+
+		/* The same work for every item */
+		const double uniform = best_of([&] () {
+			job_parallel_for(size, [&out] (int i) {
+				out[i] = busy_work(i, ITERATIONS);
+			});
+		});
+		double sums[3];
+		sums[0] = checksum(out);
+
+		/* Items near the end take far longer */
+		const double uneven = best_of([&] () {
+			job_parallel_for(size, [&out, size] (int i) {
+				out[i] = busy_work(i, (int64_t) i * i / size * 4 * ITERATIONS / size);
+			});
+		});
+		sums[1] = checksum(out);
+
+		/* Jobs that wait for jobs of their own */
+		const double nested = best_of([&] () {
+			job_parallel_for(NUM_OUTER, [&out, size] (int outer) {
+				const int first = (int64_t) size * outer / NUM_OUTER;
+				const int end = (int64_t) size * (outer + 1) / NUM_OUTER;
+				job_parallel_for(end - first, [&out, first] (int i) {
+					out[first + i] = busy_work(first + i, ITERATIONS);
+				});
+			}, 1);
+		});
+		sums[2] = checksum(out);
+
+		job_system_deinit();
+
+		if (threads == 1) {
+			std::copy(sums, sums + 3, reference);
+			uniform_1 = uniform;
+		} else if (!std::equal(sums, sums + 3, reference)) {
+			fatal("jobs: results with %i threads differ from those with 1", threads);
+		}
+
+		printf("  %-8i %12.1f %12.3f %12.3f %12.3f   (%.2fx)%s\n",
+				threads, spawn * 1e9 / num_spawned, uniform * 1e3, uneven * 1e3,
+				nested * 1e3, uniform_1 / uniform,
+				threads > num_cores ? " oversubscribed" : "");
+	}
+
+	job_system_init(app_num_threads);
+}
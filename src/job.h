@@ -0,0 +1,76 @@
+#ifndef JOB_H
+#define JOB_H
+
+#include <atomic>
+#include <functional>
+#include <type_traits>
+
+/*
+ * Work-stealing job system. Each worker thread, and the thread that
+ * started the system, has a deque of jobs: it pushes and pops at one
+ * end, and idle threads steal from the other (Chase-Lev). Any other
+ * thread hands its jobs over through a shared queue.
+ *
+ * Waiting for jobs is never idle: the waiting thread runs jobs itself,
+ * its own first, until the ones it waits for are done. So jobs may
+ * start and wait for jobs of their own.
+ *
+ * Without job_system_init(), or with a single thread, everything runs
+ * on the thread that asks for it
+ */
+
+/* --threads=<N>, counting the main thread. 0 means one per core */
+extern int app_num_threads;
+
+/* Restarts the system if it's running already, as benchmarks do */
+void job_system_init (int num_threads = 0);
+void job_system_deinit ();
+/* Including the one that started the system */
+int job_num_threads ();
+
+/*
+ * For benchmarks: calls func(num_threads) with the system restarted at
+ * 1, 2, 4... threads up to one per core, then back at --threads
+ */
+void job_for_each_thread_count (const std::function<void (int num_threads)>& func);
+
+/* Of jobs not yet done. Has to outlive them */
+struct job_counter_t {
+	std::atomic<int> pending = 0;
+};
+
+/* Runs task sometime on some thread; counter is decremented after */
+void job_run (job_counter_t& counter, std::function<void ()> task);
+/* Runs other jobs until all of the counter's are done */
+void job_wait (job_counter_t& counter);
+
+typedef void (*job_range_func_t) (void* context, int begin, int end);
+
+/*
+ * Calls func(context, begin, end) over disjoint pieces of [begin, end),
+ * on this and any idle threads, and waits until all are done.
+ *
+ * A piece is split in half only while the thread running it has nothing
+ * else queued for others to steal, and never below grain items. So the
+ * range is cut only as fine as the idle threads need. grain <= 0 picks
+ * a grain of about an eighth of each thread's share
+ */
+void job_parallel_for (int begin, int end, int grain,
+		job_range_func_t func, void* context);
+
+/* Calls func(i) for every i in [0, n) */
+template <class F>
+void job_parallel_for (int n, F&& func, int grain = 0)
+{
+	using func_t = std::remove_reference_t<F>;
+	job_parallel_for(0, n, grain, [] (void* context, int begin, int end) {
+		func_t& f = *(func_t*) context;
+		for (int i = begin; i < end; i++)
+			f(i);
+	}, (void*) &func);
+}
+
+/* --benchmark=jobs: scheduling overhead and scaling at 1 to 64 threads */
+void job_benchmark (int size);
+
+#endif /* JOB_H */
@@ -1,29 +1,47 @@
 #include "util.h"
+#include "bench.h"
 #include "gl.h"
 #include "gui.h"
 #include "input.h"
+#include "job.h"
 #include "app.h"
+#include "render_thread.h"
 
 int main (int argc, char** argv)
 {
 	for (int i = 1; i < argc; i++)
 		input_parse_cmdline_option(argv[i]);
 
+	job_system_init(app_num_threads);
+	if (app_benchmark != nullptr && !benchmark_needs_gl(app_benchmark)) {
+		benchmark_run(app_benchmark, app_benchmark_size);
+		job_system_deinit();
+		return 0;
+	}
+
 	render_init();
 	gui_init();
 	input_init();
 	app_init();
 
+	if (app_benchmark != nullptr) {
+		benchmark_run(app_benchmark, app_benchmark_size);
+		app_quit = true;
+	}
+
+	render_thread_start();
 	while (!app_quit) {
 		gui_generate_frame();
-		render_frame();
+		render_submit_frame();
 		input_handle_events();
 		app_update();
 	}
+	render_thread_stop();
 
 	app_deinit();
 	gui_deinit();
 	render_deinit();
+	job_system_deinit();
 
 	return 0;
 }
@@ -0,0 +1,141 @@
+#include "mapped_file.h"
+#include <utility>
+
+#ifdef WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char empty_file_contents[1] = { '\0' };
+
+#ifdef WINDOWS
+
+bool mapped_file_t::open (const char* path)
+{
+	close();
+
+	HANDLE f = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+			OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (f == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(f, &file_size)) {
+		CloseHandle(f);
+		return false;
+	}
+
+	if (file_size.QuadPart == 0) {
+		CloseHandle(f);
+		this->data = empty_file_contents;
+		this->size = 0;
+		this->is_empty_dummy = true;
+		return true;
+	}
+
+	HANDLE m = CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (m == nullptr) {
+		CloseHandle(f);
+		return false;
+	}
+
+	void* ptr = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+	if (ptr == nullptr) {
+		CloseHandle(m);
+		CloseHandle(f);
+		return false;
+	}
+
+	this->file_handle = f;
+	this->mapping_handle = m;
+	this->data = (const char*) ptr;
+	this->size = file_size.QuadPart;
+	return true;
+}
+
+void mapped_file_t::close ()
+{
+	if (this->data != nullptr && !this->is_empty_dummy) {
+		UnmapViewOfFile(this->data);
+		CloseHandle(this->mapping_handle);
+		CloseHandle(this->file_handle);
+	}
+	this->file_handle = nullptr;
+	this->mapping_handle = nullptr;
+	this->data = nullptr;
+	this->size = 0;
+	this->is_empty_dummy = false;
+}
+
+#else
+
+bool mapped_file_t::open (const char* path)
+{
+	close();
+
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		::close(fd);
+		return false;
+	}
+
+	if (st.st_size == 0) {
+		::close(fd);
+		this->data = empty_file_contents;
+		this->size = 0;
+		this->is_empty_dummy = true;
+		return true;
+	}
+
+	void* ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	/* The mapping keeps its own reference to the file */
+	::close(fd);
+	if (ptr == MAP_FAILED)
+		return false;
+
+	madvise(ptr, st.st_size, MADV_WILLNEED);
+
+	this->data = (const char*) ptr;
+	this->size = st.st_size;
+	return true;
+}
+
+void mapped_file_t::close ()
+{
+	if (this->data != nullptr && !this->is_empty_dummy)
+		munmap((void*) this->data, this->size);
+	this->data = nullptr;
+	this->size = 0;
+	this->is_empty_dummy = false;
+}
+
+#endif
+
+mapped_file_t::mapped_file_t (mapped_file_t&& other)
+{
+	*this = std::move(other);
+}
+
+mapped_file_t& mapped_file_t::operator= (mapped_file_t&& other)
+{
+	if (this == &other)
+		return *this;
+
+	close();
+	std::swap(this->data, other.data);
+	std::swap(this->size, other.size);
+	std::swap(this->is_empty_dummy, other.is_empty_dummy);
+#ifdef WINDOWS
+	std::swap(this->file_handle, other.file_handle);
+	std::swap(this->mapping_handle, other.mapping_handle);
+#endif
+	return *this;
+}
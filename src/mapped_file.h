@@ -0,0 +1,37 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+
+/*
+ * A read-only memory mapping of a whole file. The contents are
+ * paged in by the OS on access, so this is also the cheapest way
+ * to just read a big file once
+ */
+struct mapped_file_t {
+	const char* data = nullptr;
+	size_t size = 0;
+
+	/* On failure returns false and leaves the mapping empty */
+	bool open (const char* path);
+	void close ();
+
+	bool is_open () const { return data != nullptr; }
+
+	mapped_file_t () = default;
+	mapped_file_t (const mapped_file_t&) = delete;
+	mapped_file_t& operator= (const mapped_file_t&) = delete;
+	mapped_file_t (mapped_file_t&&);
+	mapped_file_t& operator= (mapped_file_t&&);
+	~mapped_file_t () { close(); }
+
+private:
+#ifdef WINDOWS
+	void* file_handle = nullptr;
+	void* mapping_handle = nullptr;
+#endif
+	/* Zero-length files can't be mapped, this is pointed to instead */
+	bool is_empty_dummy = false;
+};
+
+#endif /* MAPPED_FILE_H */
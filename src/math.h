@@ -12,6 +12,24 @@ using mat2 = glm::mat2;
 using mat3 = glm::mat3;
 using mat4 = glm::mat4;
 
+struct aabb_t {
+	vec3 min;
+	vec3 max;
+};
+
+/* The box around the transformed box (Arvo's method) */
+inline aabb_t aabb_transform (const aabb_t& box, const mat4& m)
+{
+	aabb_t r = { vec3(m[3]), vec3(m[3]) };
+	for (int col = 0; col < 3; col++) {
+		const vec3 a = vec3(m[col]) * box.min[col];
+		const vec3 b = vec3(m[col]) * box.max[col];
+		r.min += glm::min(a, b);
+		r.max += glm::max(a, b);
+	}
+	return r;
+}
+
 #define TEMPLATE_NSQ template<int N, class S = float, glm::qualifier Q = glm::packed>
 #define VEC_NSQ glm::vec<N, S, Q>
 
@@ -0,0 +1,405 @@
+#include "mesh.h"
+#include "gl_immediate.h"
+#include "gl_upload.h"
+#include "util.h"
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+static_assert(sizeof(mesh_vertex_t) == 8 * sizeof(uint32_t),
+	"mesh_vertex_t is hashed and compared as 8 words");
+
+/* Open addressing with linear probing, holds indices into the vertex array */
+struct weld_table_t {
+	static constexpr uint32_t EMPTY = ~uint32_t{0};
+	std::vector<uint32_t> slots;
+	uint32_t mask;
+
+	void reset (uint32_t capacity)
+	{
+		slots.assign(capacity, EMPTY);
+		mask = capacity - 1;
+	}
+};
+
+static uint32_t hash_vertex (const mesh_vertex_t& v)
+{
+	uint32_t w[8];
+	memcpy(w, &v, sizeof(w));
+
+	uint64_t h = 0;
+	for (int i = 0; i < 8; i++)
+		h = (h ^ w[i]) * 0x9e3779b97f4a7c15;
+	return h >> 32;
+}
+
+/* Index of the vertex equal to v, which gets added if there is none */
+static uint32_t weld_vertex (weld_table_t& table,
+		std::vector<mesh_vertex_t>& vertices, const mesh_vertex_t& v)
+{
+	uint32_t slot = hash_vertex(v) & table.mask;
+	while (true) {
+		const uint32_t i = table.slots[slot];
+		if (i == weld_table_t::EMPTY)
+			break;
+		if (memcmp(&vertices[i], &v, sizeof(v)) == 0)
+			return i;
+		slot = (slot + 1) & table.mask;
+	}
+
+	const uint32_t index = vertices.size();
+	vertices.push_back(v);
+	table.slots[slot] = index;
+
+	/* Keep the load factor under 1/2 so that the probes stay short */
+	if (vertices.size() * 2 > table.slots.size()) {
+		table.reset(table.slots.size() * 2);
+		for (uint32_t k = 0; k < vertices.size(); k++) {
+			uint32_t s = hash_vertex(vertices[k]) & table.mask;
+			while (table.slots[s] != weld_table_t::EMPTY)
+				s = (s + 1) & table.mask;
+			table.slots[s] = k;
+		}
+	}
+	return index;
+}
+
+mesh_data_t mesh_data_from_obj (const obj_model_t& obj, const char* name)
+{
+	const double t_start = time_seconds();
+	mesh_data_t mesh;
+
+	const int num_corners = obj.corners.size();
+	mesh.indices.resize(num_corners);
+
+	/* A guess; most corners share their position with a few others */
+	weld_table_t table;
+	table.reset(ceil_po2<uint32_t>(std::max<size_t>(obj.positions.size(), 32) * 2));
+	mesh.vertices.reserve(obj.positions.size());
+
+	for (int tri = 0; tri < num_corners; tri += 3) {
+		const obj_corner_t* c = &obj.corners[tri];
+
+		/* Corners without normals get the one of the face */
+		const vec3 p0 = obj.positions[c[0].position];
+		const vec3 p1 = obj.positions[c[1].position];
+		const vec3 p2 = obj.positions[c[2].position];
+		vec3 face_normal = glm::cross(p1 - p0, p2 - p0);
+		if (face_normal != vec3(0.0))
+			face_normal = glm::normalize(face_normal);
+
+		for (int k = 0; k < 3; k++) {
+			mesh_vertex_t v;
+			v.position = obj.positions[c[k].position];
+			v.normal = (c[k].normal >= 0) ? obj.normals[c[k].normal]
+			                              : face_normal;
+			v.tex_coord = (c[k].tex_coord >= 0) ? obj.tex_coords[c[k].tex_coord]
+			                                    : vec2(0.0);
+			mesh.indices[tri + k] = weld_vertex(table, mesh.vertices, v);
+		}
+	}
+	mesh.vertices.shrink_to_fit();
+
+	for (const obj_object_t& o: obj.objects)
+		mesh.submeshes.push_back({ o.name, 3u * o.first_triangle,
+		                           3u * o.num_triangles });
+
+	mesh.bounds = { vec3(0.0), vec3(0.0) };
+	if (!mesh.vertices.empty()) {
+		mesh.bounds = { mesh.vertices[0].position, mesh.vertices[0].position };
+		for (const mesh_vertex_t& v: mesh.vertices) {
+			mesh.bounds.min = glm::min(mesh.bounds.min, v.position);
+			mesh.bounds.max = glm::max(mesh.bounds.max, v.position);
+		}
+	}
+
+	const int num_vertices = mesh.vertices.size();
+	info("Mesh %s: welded %i corners into %i vertices (%.2fx), "
+	     "%i-bit indices, in %.1f ms",
+	     name, num_corners, num_vertices,
+	     num_vertices > 0 ? (double) num_corners / num_vertices : 0.0,
+	     8 * mesh_index_size(mesh_index_type(num_vertices)),
+	     (time_seconds() - t_start) * 1e3);
+
+	return mesh;
+}
+
+GLenum mesh_index_type (uint32_t num_vertices)
+{
+	return (num_vertices <= 0x10000) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+int mesh_index_size (GLenum index_type)
+{
+	return (index_type == GL_UNSIGNED_SHORT) ? 2 : 4;
+}
+
+GLenum mesh_pack_indices (const mesh_data_t& mesh, std::vector<uint8_t>& out)
+{
+	const GLenum type = mesh_index_type(mesh.vertices.size());
+	const size_t n = mesh.indices.size();
+
+	if (type == GL_UNSIGNED_SHORT) {
+		out.resize(n * sizeof(uint16_t));
+		uint16_t* dst = (uint16_t*) out.data();
+		for (size_t i = 0; i < n; i++)
+			dst[i] = mesh.indices[i];
+	} else {
+		out.resize(n * sizeof(uint32_t));
+		memcpy(out.data(), mesh.indices.data(), out.size());
+	}
+	return type;
+}
+
+void mesh_vertex_attribs ()
+{
+	using namespace imm::attrib_loc;
+	gl_vertex_attrib_ptr(POSITION, 3, GL_FLOAT, false, sizeof(mesh_vertex_t),
+	                     offsetof(mesh_vertex_t, position));
+	gl_vertex_attrib_ptr(NORMAL, 3, GL_FLOAT, false, sizeof(mesh_vertex_t),
+	                     offsetof(mesh_vertex_t, normal));
+	gl_vertex_attrib_ptr(TEX_COORD, 2, GL_FLOAT, false, sizeof(mesh_vertex_t),
+	                     offsetof(mesh_vertex_t, tex_coord));
+}
+
+mesh_data_t mesh_data_box ()
+{
+	mesh_data_t box;
+	for (int axis = 0; axis < 3; axis++) {
+		for (float side: { -1.0f, 1.0f }) {
+			vec3 n(0.0);
+			n[axis] = side;
+			/* u x v points along n, so that the faces wind CCW from outside */
+			vec3 u(0.0), v(0.0);
+			u[(axis + 1) % 3] = side;
+			v[(axis + 2) % 3] = 1.0;
+
+			const uint32_t base = box.vertices.size();
+			for (vec2 t: { vec2(0, 0), vec2(1, 0), vec2(1, 1), vec2(0, 1) }) {
+				const vec3 p = 0.5f * (n + (2.0f * t.x - 1.0f) * u
+				                         + (2.0f * t.y - 1.0f) * v);
+				box.vertices.push_back({ p, n, t });
+			}
+			for (uint32_t i: { 0, 1, 2, 0, 2, 3 })
+				box.indices.push_back(base + i);
+		}
+	}
+	box.submeshes.push_back({ "box", 0, (uint32_t) box.indices.size() });
+	box.bounds = { vec3(-0.5), vec3(0.5) };
+	return box;
+}
+
+/* ================ ARENA ================ */
+
+/* Index ranges are in 4 byte units, so either index type is aligned */
+static constexpr size_t INDEX_UNIT = sizeof(uint32_t);
+
+static gpu_arena_t vertex_arena;
+static gpu_arena_t index_arena;
+/* The second one also has the per-instance model matrix */
+static GLuint arena_vao;
+static GLuint arena_instanced_vao;
+/* The arenas' generations the VAOs were set up for */
+static uint32_t vao_vertex_generation;
+static uint32_t vao_index_generation;
+
+/* The buffers change when the arenas grow */
+static void setup_arena_vaos ()
+{
+	for (GLuint vao: { arena_vao, arena_instanced_vao }) {
+		gl_bind_vertex_array(vao);
+		gl_bind_buffer(GL_ARRAY_BUFFER, vertex_arena.buffer);
+		gl_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, index_arena.buffer);
+		mesh_vertex_attribs();
+	}
+	/* The instanced one is still bound */
+	for (int col = 0; col < 4; col++)
+		glVertexAttribDivisor(MESH_INSTANCE_MODEL_LOC + col, 1);
+
+	vao_vertex_generation = vertex_arena.generation;
+	vao_index_generation = index_arena.generation;
+}
+
+void mesh_arena_init ()
+{
+	vertex_arena.init(sizeof(mesh_vertex_t), (4 << 20) / sizeof(mesh_vertex_t));
+	index_arena.init(INDEX_UNIT, (2 << 20) / INDEX_UNIT);
+	arena_vao = gl_gen_vertex_array();
+	arena_instanced_vao = gl_gen_vertex_array();
+	setup_arena_vaos();
+	gl_bind_vertex_array(0);
+}
+
+void mesh_arena_deinit ()
+{
+	if (vertex_arena.ranges.num_allocations != 0)
+		warning("%i meshes left in the arena", vertex_arena.ranges.num_allocations);
+	gl_delete_vertex_array(arena_vao);
+	gl_delete_vertex_array(arena_instanced_vao);
+	vertex_arena.deinit();
+	index_arena.deinit();
+}
+
+void mesh_arena_bind (bool instanced)
+{
+	if (vao_vertex_generation != vertex_arena.generation
+	 || vao_index_generation != index_arena.generation)
+		setup_arena_vaos();
+	gl_bind_vertex_array(instanced ? arena_instanced_vao : arena_vao);
+}
+
+void mesh_instance_attribs (GLuint buffer, size_t offset)
+{
+	gl_bind_buffer(GL_ARRAY_BUFFER, buffer);
+	for (int col = 0; col < 4; col++) {
+		gl_vertex_attrib_ptr(MESH_INSTANCE_MODEL_LOC + col, 4, GL_FLOAT, false,
+		                     sizeof(mat4), offset + col * sizeof(vec4));
+	}
+}
+
+mesh_arena_stats_t mesh_arena_stats ()
+{
+	return { vertex_arena.stats(), index_arena.stats() };
+}
+
+mesh_t mesh_upload (const mesh_vertex_t* vertices, uint32_t num_vertices,
+		const void* indices, uint32_t num_indices, GLenum index_type)
+{
+	mesh_t mesh;
+	mesh.num_vertices = num_vertices;
+	mesh.num_indices = num_indices;
+	mesh.index_type = index_type;
+
+	const size_t vertex_bytes = sizeof(mesh_vertex_t) * num_vertices;
+	const size_t index_bytes = mesh_index_size(index_type) * num_indices;
+	mesh.vertex_range = vertex_arena.alloc(vertex_bytes);
+	mesh.index_range = index_arena.alloc(index_bytes);
+	vertex_arena.upload(mesh.vertex_range, vertices, vertex_bytes);
+	index_arena.upload(mesh.index_range, indices, index_bytes);
+
+	mesh.base_vertex = vertex_arena.ranges.offset(mesh.vertex_range);
+	mesh.index_offset = index_arena.offset_bytes(mesh.index_range);
+	return mesh;
+}
+
+mesh_t mesh_upload (const mesh_data_t& data, bool keep_cpu_copy)
+{
+	std::vector<uint8_t> indices;
+	const GLenum index_type = mesh_pack_indices(data, indices);
+
+	mesh_t mesh = mesh_upload(data.vertices.data(), data.vertices.size(),
+			indices.data(), data.indices.size(), index_type);
+	mesh.submeshes = data.submeshes;
+	mesh.bounds = data.bounds;
+	if (keep_cpu_copy)
+		mesh.cpu_copy = data;
+	return mesh;
+}
+
+/* ================ BACKGROUND UPLOADS ================ */
+
+/* What's only known of a mesh once it's uploaded */
+struct uploading_mesh_t {
+	mesh_t* mesh;
+	uint32_t num_indices;
+	size_t vertex_bytes;
+	size_t index_bytes;
+};
+/* By upload id */
+static std::unordered_map<uint32_t, uploading_mesh_t> uploading_meshes;
+
+void mesh_upload_async (mesh_t& mesh, const mesh_vertex_t* vertices, uint32_t num_vertices,
+		const void* indices, uint32_t num_indices, GLenum index_type,
+		std::shared_ptr<const void> keep_alive)
+{
+	const size_t vertex_bytes = sizeof(mesh_vertex_t) * num_vertices;
+	const size_t index_bytes = mesh_index_size(index_type) * num_indices;
+	const uint32_t id = gl_upload_submit({ { vertices, vertex_bytes }, { indices, index_bytes } },
+			std::move(keep_alive));
+	if (id == 0) {
+		mesh = mesh_upload(vertices, num_vertices, indices, num_indices, index_type);
+		return;
+	}
+
+	mesh = { };
+	mesh.vertex_range = range_allocator_t::NONE;
+	mesh.index_range = range_allocator_t::NONE;
+	mesh.num_vertices = num_vertices;
+	mesh.index_type = index_type;
+	uploading_meshes[id] = { &mesh, num_indices, vertex_bytes, index_bytes };
+}
+
+void mesh_upload_async (mesh_t& mesh, mesh_data_t data, bool keep_cpu_copy)
+{
+	struct packed_t {
+		std::vector<mesh_vertex_t> vertices;
+		std::vector<uint8_t> indices;
+	};
+	auto packed = std::make_shared<packed_t>();
+	const GLenum index_type = mesh_pack_indices(data, packed->indices);
+	if (keep_cpu_copy)
+		packed->vertices = data.vertices;
+	else
+		packed->vertices = std::move(data.vertices);
+
+	mesh_upload_async(mesh, packed->vertices.data(), packed->vertices.size(),
+			packed->indices.data(), data.indices.size(), index_type, packed);
+	mesh.submeshes = data.submeshes;
+	mesh.bounds = data.bounds;
+	if (keep_cpu_copy)
+		mesh.cpu_copy = std::move(data);
+}
+
+void mesh_poll_uploads ()
+{
+	gl_upload_done_t done;
+	while (gl_upload_poll(done)) {
+		const auto it = uploading_meshes.find(done.id);
+		/* Or it was destroyed in the meantime */
+		if (it != uploading_meshes.end()) {
+			const uploading_mesh_t& u = it->second;
+			mesh_t& mesh = *u.mesh;
+			mesh.vertex_range = vertex_arena.alloc(u.vertex_bytes);
+			mesh.index_range = index_arena.alloc(u.index_bytes);
+			vertex_arena.copy(mesh.vertex_range, done.buffer, done.offsets[0], u.vertex_bytes);
+			index_arena.copy(mesh.index_range, done.buffer, done.offsets[1], u.index_bytes);
+
+			mesh.base_vertex = vertex_arena.ranges.offset(mesh.vertex_range);
+			mesh.index_offset = index_arena.offset_bytes(mesh.index_range);
+			mesh.num_indices = u.num_indices;
+			uploading_meshes.erase(it);
+		}
+		gl_delete_buffer(done.buffer);
+	}
+}
+
+void mesh_destroy (mesh_t& mesh)
+{
+	if (mesh.vertex_range == range_allocator_t::NONE) {
+		for (auto it = uploading_meshes.begin(); it != uploading_meshes.end(); ++it) {
+			if (it->second.mesh == &mesh) {
+				uploading_meshes.erase(it);
+				break;
+			}
+		}
+	} else {
+		vertex_arena.free(mesh.vertex_range);
+		index_arena.free(mesh.index_range);
+	}
+	mesh.vertex_range = range_allocator_t::NONE;
+	mesh.index_range = range_allocator_t::NONE;
+	mesh.num_indices = 0;
+	mesh.cpu_copy = { };
+}
+
+void mesh_draw (const mesh_t& mesh)
+{
+	glDrawElementsBaseVertex(GL_TRIANGLES, mesh.num_indices, mesh.index_type,
+			(void*) mesh.index_offset, mesh.base_vertex);
+}
+
+void mesh_draw_instanced (const mesh_t& mesh, int num_instances)
+{
+	glDrawElementsInstancedBaseVertex(GL_TRIANGLES, mesh.num_indices, mesh.index_type,
+			(void*) mesh.index_offset, num_instances, mesh.base_vertex);
+}
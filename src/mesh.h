@@ -0,0 +1,130 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include "gl.h"
+#include "gpu_arena.h"
+#include "math.h"
+#include "obj.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * The vertex format of all meshes. Attributes go to the same
+ * locations as with imm::, so that the same shaders work with both
+ */
+struct mesh_vertex_t {
+	vec3 position;
+	vec3 normal;
+	vec2 tex_coord;
+};
+
+/* A range of the index buffer, one per OBJ object */
+struct submesh_t {
+	std::string name;
+	uint32_t first_index;
+	uint32_t num_indices;
+};
+
+/* A triangle mesh as it is in CPU memory, ready to be uploaded */
+struct mesh_data_t {
+	std::vector<mesh_vertex_t> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<submesh_t> submeshes;
+	aabb_t bounds;
+};
+
+/*
+ * Corners with identical position, normal and texture coordinates
+ * are welded into one vertex. `name` is only for the report
+ */
+mesh_data_t mesh_data_from_obj (const obj_model_t& obj, const char* name);
+
+/* The smallest index type that can address that many vertices */
+GLenum mesh_index_type (uint32_t num_vertices);
+int mesh_index_size (GLenum index_type);
+
+/* Narrows the indices to mesh_index_type() for storage and upload */
+GLenum mesh_pack_indices (const mesh_data_t& mesh, std::vector<uint8_t>& out);
+
+/* Sets up mesh_vertex_t attributes for the bound VAO and GL_ARRAY_BUFFER */
+void mesh_vertex_attribs ();
+
+/* Instanced drawing takes the model matrix from here, a column per location */
+static constexpr int MESH_INSTANCE_MODEL_LOC = 4;
+
+/* A 1x1x1 box around the origin, for props and placeholders */
+mesh_data_t mesh_data_box ();
+
+/*
+ * All meshes live in one arena of vertices and one of indices on the GPU,
+ * so that drawing any number of them only takes binding one VAO (there
+ * being one vertex format). Set up with the renderer
+ */
+void mesh_arena_init ();
+void mesh_arena_deinit ();
+void mesh_arena_bind (bool instanced = false);
+/*
+ * With the instanced VAO bound: the model matrices of the instances
+ * come from this buffer, a mat4 each from `offset` bytes on
+ */
+void mesh_instance_attribs (GLuint buffer, size_t offset = 0);
+
+struct mesh_arena_stats_t {
+	gpu_arena_stats_t vertices;
+	gpu_arena_stats_t indices;
+};
+mesh_arena_stats_t mesh_arena_stats ();
+
+/*
+ * A mesh uploaded into the arena once, then drawn any number of times
+ * without touching its vertices again. Its indices count from its first
+ * vertex, and can be 16 bit even if the arena has more vertices than
+ * that. The CPU copy is only there if it was asked to be kept
+ */
+struct mesh_t {
+	uint32_t vertex_range;
+	uint32_t index_range;
+
+	int32_t base_vertex;
+	/* Byte offset into the index arena */
+	size_t index_offset;
+	uint32_t num_vertices;
+	uint32_t num_indices;
+	GLenum index_type;
+
+	std::vector<submesh_t> submeshes;
+	aabb_t bounds;
+
+	mesh_data_t cpu_copy;
+};
+
+/* The indices are of index_type, as packed by mesh_pack_indices() */
+mesh_t mesh_upload (const mesh_vertex_t* vertices, uint32_t num_vertices,
+		const void* indices, uint32_t num_indices, GLenum index_type);
+mesh_t mesh_upload (const mesh_data_t& data, bool keep_cpu_copy = false);
+
+/*
+ * Like mesh_upload(), but copied to the GPU on the upload thread
+ * (gl_upload.h), so that a big mesh doesn't hold up a frame. Its bounds,
+ * submeshes and CPU copy are there right away; until mesh_poll_uploads()
+ * finds it uploaded it has no indices, so it's drawn as nothing. The
+ * mesh has to stay where it is until then, or be destroyed.
+ * Without an upload thread it's uploaded right away.
+ *
+ * keep_alive owns what the pointers point into
+ */
+void mesh_upload_async (mesh_t& mesh, const mesh_vertex_t* vertices, uint32_t num_vertices,
+		const void* indices, uint32_t num_indices, GLenum index_type,
+		std::shared_ptr<const void> keep_alive);
+void mesh_upload_async (mesh_t& mesh, mesh_data_t data, bool keep_cpu_copy = false);
+/* Before drawing: puts the meshes that are uploaded by now in the arena */
+void mesh_poll_uploads ();
+
+void mesh_destroy (mesh_t& mesh);
+
+/* With whatever program is in use, after mesh_arena_bind() */
+void mesh_draw (const mesh_t& mesh);
+void mesh_draw_instanced (const mesh_t& mesh, int num_instances);
+
+#endif /* MESH_H */
@@ -0,0 +1,369 @@
+#include "mesh_cache.h"
+#include "mesh_optimize.h"
+#include "util.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+static constexpr char CMESH_MAGIC[4] = { 'C', 'M', 'S', 'H' };
+/* Bump whenever the layout or anything about importing changes */
+static constexpr uint32_t CMESH_VERSION = 3;
+static constexpr const char* CMESH_EXTENSION = ".cmesh";
+/* Blocks start at offsets aligned to this */
+static constexpr size_t CMESH_BLOCK_ALIGN = 64;
+
+struct cmesh_header_t {
+	char magic[4];
+	uint32_t version;
+
+	/* What the cache was made from */
+	uint64_t source_size;
+	int64_t source_mtime;
+	uint64_t source_hash;
+
+	uint32_t vertex_size;
+	uint32_t index_size;
+	uint32_t num_vertices;
+	uint32_t num_indices;
+	uint32_t num_submeshes;
+	uint32_t optimize_level;
+
+	aabb_t bounds;
+
+	/* Byte offsets from the start of the file */
+	uint64_t vertex_offset;
+	uint64_t index_offset;
+	uint64_t submesh_offset;
+};
+
+struct cmesh_submesh_t {
+	uint32_t first_index;
+	uint32_t num_indices;
+	char name[56];
+};
+
+struct source_stamp_t {
+	uint64_t size;
+	int64_t mtime;
+};
+
+static size_t align_up (size_t x)
+{
+	return (x + CMESH_BLOCK_ALIGN - 1) & ~(CMESH_BLOCK_ALIGN - 1);
+}
+
+static bool get_source_stamp (const char* path, source_stamp_t& stamp)
+{
+	std::error_code err;
+	stamp.size = std::filesystem::file_size(path, err);
+	if (err)
+		return false;
+	stamp.mtime = std::filesystem::last_write_time(path, err)
+	                      .time_since_epoch().count();
+	return !err;
+}
+
+static uint64_t hash_file (const char* path)
+{
+	mapped_file_t f;
+	if (!f.open(path))
+		fatal("Mesh %s: cannot open file: %s", path, strerror(errno));
+	return hash_bytes(f.data, f.size);
+}
+
+/* Points the mesh into the mapping, which has been checked to be sane */
+static void use_mapping (cached_mesh_t& mesh)
+{
+	const char* base = mesh.file.data;
+	const cmesh_header_t* h = (const cmesh_header_t*) base;
+
+	mesh.vertices = (const mesh_vertex_t*) (base + h->vertex_offset);
+	mesh.num_vertices = h->num_vertices;
+	mesh.indices = base + h->index_offset;
+	mesh.num_indices = h->num_indices;
+	mesh.index_type = mesh_index_type(h->num_vertices);
+	mesh.bounds = h->bounds;
+
+	const cmesh_submesh_t* subs = (const cmesh_submesh_t*) (base + h->submesh_offset);
+	mesh.submeshes.clear();
+	for (int i = 0; i < h->num_submeshes; i++) {
+		const cmesh_submesh_t& s = subs[i];
+		mesh.submeshes.push_back({ std::string(s.name, strnlen(s.name, sizeof(s.name))),
+		                           s.first_index, s.num_indices });
+	}
+}
+
+/* Whether the header makes sense for a file of this size */
+static bool header_is_sane (const cmesh_header_t& h, size_t file_size)
+{
+	auto block_fits = [file_size] (uint64_t offset, uint64_t count, uint64_t elem_size) {
+		return offset % CMESH_BLOCK_ALIGN == 0
+		    && offset <= file_size
+		    && count <= (file_size - offset) / elem_size;
+	};
+
+	return memcmp(h.magic, CMESH_MAGIC, sizeof(CMESH_MAGIC)) == 0
+	    && h.version == CMESH_VERSION
+	    && h.vertex_size == sizeof(mesh_vertex_t)
+	    && h.index_size == mesh_index_size(mesh_index_type(h.num_vertices))
+	    && block_fits(h.vertex_offset, h.num_vertices, h.vertex_size)
+	    && block_fits(h.index_offset, h.num_indices, h.index_size)
+	    && block_fits(h.submesh_offset, h.num_submeshes, sizeof(cmesh_submesh_t));
+}
+
+/* Whether the submeshes are within the indices, once the header is sane */
+static bool submeshes_are_sane (const char* base)
+{
+	const cmesh_header_t* h = (const cmesh_header_t*) base;
+	const cmesh_submesh_t* subs = (const cmesh_submesh_t*) (base + h->submesh_offset);
+	for (int i = 0; i < h->num_submeshes; i++) {
+		if ((uint64_t) subs[i].first_index + subs[i].num_indices > h->num_indices)
+			return false;
+	}
+	return true;
+}
+
+template <class T>
+static bool indices_below (const T* indices, uint32_t num_indices, uint32_t num_vertices)
+{
+	/* The largest, without a branch per index */
+	T max_index = 0;
+	for (uint32_t i = 0; i < num_indices; i++)
+		max_index = std::max(max_index, indices[i]);
+	return num_indices == 0 || max_index < num_vertices;
+}
+
+/* Whether every index is of a vertex, once the header is sane */
+static bool indices_are_sane (const char* base)
+{
+	const cmesh_header_t* h = (const cmesh_header_t*) base;
+	const char* indices = base + h->index_offset;
+	if (mesh_index_type(h->num_vertices) == GL_UNSIGNED_SHORT)
+		return indices_below((const uint16_t*) indices, h->num_indices, h->num_vertices);
+	return indices_below((const uint32_t*) indices, h->num_indices, h->num_vertices);
+}
+
+static bool mapping_is_sane (const mapped_file_t& f)
+{
+	return f.size >= sizeof(cmesh_header_t)
+	    && header_is_sane(*(const cmesh_header_t*) f.data, f.size)
+	    && submeshes_are_sane(f.data)
+	    && indices_are_sane(f.data);
+}
+
+/*
+ * Maps the cache if it's up to date with the source.
+ * Otherwise returns why not, to be reported
+ */
+static const char* try_load_cache (const std::string& cache_path,
+		const char* obj_path, const source_stamp_t& stamp,
+		mesh_optimize_level_t level, cached_mesh_t& mesh)
+{
+	if (!mesh.file.open(cache_path.c_str()))
+		return "no cache";
+
+	if (!mapping_is_sane(mesh.file)) {
+		mesh.file.close();
+		return "cache is invalid or of an old version";
+	}
+
+	cmesh_header_t h = *(const cmesh_header_t*) mesh.file.data;
+	if (h.source_size != stamp.size) {
+		mesh.file.close();
+		return "source changed";
+	}
+	if (h.optimize_level != level) {
+		mesh.file.close();
+		return "optimization level changed";
+	}
+
+	if (h.source_mtime != stamp.mtime) {
+		/* Touched, but maybe not actually changed */
+		if (hash_file(obj_path) != h.source_hash) {
+			mesh.file.close();
+			return "source changed";
+		}
+
+		/* Remember the new time so as not to rehash next time */
+		mesh.file.close();
+		h.source_mtime = stamp.mtime;
+		if (FILE* f = fopen(cache_path.c_str(), "r+b"); f != nullptr) {
+			fwrite(&h, sizeof(h), 1, f);
+			fclose(f);
+		}
+		if (!mesh.file.open(cache_path.c_str()))
+			return "cache disappeared";
+		/* It may have been replaced meanwhile */
+		if (!mapping_is_sane(mesh.file)) {
+			mesh.file.close();
+			return "cache is invalid or of an old version";
+		}
+	}
+
+	use_mapping(mesh);
+	return nullptr;
+}
+
+static bool write_padding (FILE* f)
+{
+	static const char zeros[CMESH_BLOCK_ALIGN] = { };
+	const long pos = ftell(f);
+	return pos >= 0 && fwrite(zeros, 1, align_up(pos) - pos, f) == align_up(pos) - pos;
+}
+
+static bool write_cache (const std::string& cache_path,
+		const mesh_data_t& mesh, const std::vector<uint8_t>& indices,
+		const source_stamp_t& stamp, uint64_t hash, mesh_optimize_level_t level)
+{
+	cmesh_header_t h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, CMESH_MAGIC, sizeof(CMESH_MAGIC));
+	h.version = CMESH_VERSION;
+	h.source_size = stamp.size;
+	h.source_mtime = stamp.mtime;
+	h.source_hash = hash;
+	h.vertex_size = sizeof(mesh_vertex_t);
+	h.index_size = mesh_index_size(mesh_index_type(mesh.vertices.size()));
+	h.num_vertices = mesh.vertices.size();
+	h.num_indices = mesh.indices.size();
+	h.num_submeshes = mesh.submeshes.size();
+	h.optimize_level = level;
+	h.bounds = mesh.bounds;
+
+	const size_t vertex_bytes = mesh.vertices.size() * sizeof(mesh_vertex_t);
+	const size_t index_bytes = indices.size();
+	h.vertex_offset = align_up(sizeof(h));
+	h.index_offset = align_up(h.vertex_offset + vertex_bytes);
+	h.submesh_offset = align_up(h.index_offset + index_bytes);
+
+	std::vector<cmesh_submesh_t> subs(mesh.submeshes.size());
+	for (int i = 0; i < subs.size(); i++) {
+		const submesh_t& s = mesh.submeshes[i];
+		memset(&subs[i], 0, sizeof(subs[i]));
+		subs[i].first_index = s.first_index;
+		subs[i].num_indices = s.num_indices;
+		strncpy(subs[i].name, s.name.c_str(), sizeof(subs[i].name) - 1);
+	}
+
+	/* Write to the side first so that a half-written cache is never seen */
+	const std::string tmp_path = cache_path + ".tmp";
+	FILE* f = fopen(tmp_path.c_str(), "wb");
+	if (f == nullptr)
+		return false;
+
+	bool ok = fwrite(&h, sizeof(h), 1, f) == 1
+	       && write_padding(f)
+	       && fwrite(mesh.vertices.data(), 1, vertex_bytes, f) == vertex_bytes
+	       && write_padding(f)
+	       && fwrite(indices.data(), 1, index_bytes, f) == index_bytes
+	       && write_padding(f)
+	       && fwrite(subs.data(), sizeof(cmesh_submesh_t), subs.size(), f) == subs.size();
+	ok = (fclose(f) == 0) && ok;
+
+	std::error_code err;
+	if (ok)
+		std::filesystem::rename(tmp_path, cache_path, err);
+	if (!ok || err) {
+		std::filesystem::remove(tmp_path, err);
+		return false;
+	}
+	return true;
+}
+
+cached_mesh_t mesh_cache_load (const char* obj_path)
+{
+	const double t_start = time_seconds();
+	const std::string cache_path = obj_path + std::string(CMESH_EXTENSION);
+
+	source_stamp_t stamp;
+	if (!get_source_stamp(obj_path, stamp))
+		fatal("Mesh %s: cannot open file", obj_path);
+
+	const mesh_optimize_level_t level = mesh_optimize_level_for(obj_path);
+
+	cached_mesh_t mesh;
+	const char* miss_reason = try_load_cache(cache_path, obj_path, stamp, level, mesh);
+	if (miss_reason == nullptr) {
+		info("Mesh %s: cache hit, loaded in %.1f ms",
+				obj_path, (time_seconds() - t_start) * 1e3);
+		return mesh;
+	}
+
+	const uint64_t hash = hash_file(obj_path);
+	mesh_data_t data = mesh_data_from_obj(obj_load(obj_path), obj_path);
+	mesh_optimize(data, level, obj_path);
+	std::vector<uint8_t> indices;
+	const GLenum index_type = mesh_pack_indices(data, indices);
+	const double t_imported = time_seconds();
+
+	if (write_cache(cache_path, data, indices, stamp, hash, level)
+	 && mesh.file.open(cache_path.c_str())) {
+		use_mapping(mesh);
+	} else {
+		warning("Mesh %s: cannot write cache %s", obj_path, cache_path.c_str());
+		mesh.imported = std::move(data);
+		mesh.vertices = mesh.imported.vertices.data();
+		mesh.num_vertices = mesh.imported.vertices.size();
+		mesh.imported_indices = std::move(indices);
+		mesh.indices = mesh.imported_indices.data();
+		mesh.num_indices = mesh.imported.indices.size();
+		mesh.index_type = index_type;
+		mesh.submeshes = mesh.imported.submeshes;
+		mesh.bounds = mesh.imported.bounds;
+	}
+
+	info("Mesh %s: cache miss (%s), imported in %.1f ms, cached in %.1f ms",
+			obj_path, miss_reason,
+			(t_imported - t_start) * 1e3,
+			(time_seconds() - t_imported) * 1e3);
+	return mesh;
+}
+
+static void copy_to_cpu (const cached_mesh_t& cached, mesh_data_t& cpu)
+{
+	cpu.vertices.assign(cached.vertices, cached.vertices + cached.num_vertices);
+	cpu.indices.resize(cached.num_indices);
+	for (uint32_t i = 0; i < cached.num_indices; i++) {
+		cpu.indices[i] = cached.index_type == GL_UNSIGNED_SHORT
+			? ((const uint16_t*) cached.indices)[i]
+			: ((const uint32_t*) cached.indices)[i];
+	}
+	cpu.submeshes = cached.submeshes;
+	cpu.bounds = cached.bounds;
+}
+
+mesh_t mesh_cache_upload (const cached_mesh_t& cached, bool keep_cpu_copy)
+{
+	/* The driver makes the only copy */
+	mesh_t mesh = mesh_upload(cached.vertices, cached.num_vertices,
+			cached.indices, cached.num_indices, cached.index_type);
+	mesh.submeshes = cached.submeshes;
+	mesh.bounds = cached.bounds;
+	if (keep_cpu_copy)
+		copy_to_cpu(cached, mesh.cpu_copy);
+	return mesh;
+}
+
+void mesh_cache_upload_async (mesh_t& mesh, cached_mesh_t&& cached, bool keep_cpu_copy)
+{
+	/* Moving it keeps the pointers valid, they're into the mapping or the heap */
+	auto owned = std::make_shared<cached_mesh_t>(std::move(cached));
+	mesh_upload_async(mesh, owned->vertices, owned->num_vertices,
+			owned->indices, owned->num_indices, owned->index_type, owned);
+	mesh.submeshes = owned->submeshes;
+	mesh.bounds = owned->bounds;
+	if (keep_cpu_copy)
+		copy_to_cpu(*owned, mesh.cpu_copy);
+}
+
+mesh_t mesh_load (const char* obj_path, bool keep_cpu_copy)
+{
+	return mesh_cache_upload(mesh_cache_load(obj_path), keep_cpu_copy);
+}
+
+void mesh_load_async (mesh_t& mesh, const char* obj_path, bool keep_cpu_copy)
+{
+	mesh_cache_upload_async(mesh, mesh_cache_load(obj_path), keep_cpu_copy);
+}
@@ -0,0 +1,50 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "mapped_file.h"
+#include "mesh.h"
+
+/*
+ * Importing an OBJ is slow, so the result is saved next to it as
+ * a .cmesh file, which afterwards is just memory-mapped. Its vertex
+ * and index blocks are laid out exactly like the GL buffers they go to,
+ * so that they can be uploaded directly out of the mapping.
+ *
+ * The cache is stale if the OBJ's size changed, or its modification
+ * time changed and so did its contents.
+ */
+
+struct cached_mesh_t {
+	const mesh_vertex_t* vertices;
+	uint32_t num_vertices;
+	const void* indices;
+	uint32_t num_indices;
+	GLenum index_type;
+
+	std::vector<submesh_t> submeshes;
+	aabb_t bounds;
+
+	/* What the pointers point into: the mapping... */
+	mapped_file_t file;
+	/* ...or the freshly imported mesh, if the cache couldn't be written */
+	mesh_data_t imported;
+	std::vector<uint8_t> imported_indices;
+};
+
+/* Dies if the OBJ can't be loaded; problems with the cache are warnings */
+cached_mesh_t mesh_cache_load (const char* obj_path);
+
+/* Uploads straight out of the mapping */
+mesh_t mesh_cache_upload (const cached_mesh_t& mesh, bool keep_cpu_copy = false);
+
+/*
+ * With mesh_upload_async(), still out of the mapping, which is closed
+ * once the upload thread is done with it
+ */
+void mesh_cache_upload_async (mesh_t& mesh, cached_mesh_t&& cached, bool keep_cpu_copy = false);
+
+/* mesh_cache_load() and upload; the mapping is closed afterwards */
+mesh_t mesh_load (const char* obj_path, bool keep_cpu_copy = false);
+void mesh_load_async (mesh_t& mesh, const char* obj_path, bool keep_cpu_copy = false);
+
+#endif /* MESH_CACHE_H */
@@ -0,0 +1,424 @@
+#include "mesh_optimize.h"
+#include "util.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+
+const char* app_mesh_optimize = nullptr;
+
+/* The cache size the reordering aims for; being off isn't too bad */
+static constexpr int CACHE_SIZE = 32;
+/* What ACMR/ATVR are reported for, and what overdraw clusters are cut by */
+static constexpr int FIFO_CACHE_SIZE = 16;
+/* How much worse a cluster's miss ratio can be than the whole mesh's */
+static constexpr float CLUSTER_ACMR_THRESHOLD = 1.05;
+
+static constexpr uint32_t NONE = ~uint32_t{0};
+
+/* ================ COMMAND LINE ================ */
+
+static const char* level_names[] = { "none", "cache", "full" };
+
+static mesh_optimize_level_t parse_level (const std::string& s)
+{
+	for (int i = 0; i < 3; i++) {
+		if (s == level_names[i])
+			return (mesh_optimize_level_t) i;
+	}
+	fatal("--mesh-optimize: unknown level \"%s\", "
+	      "expected one of none, cache, full", s.c_str());
+}
+
+/* Whether the prefix given on the command line refers to this mesh */
+static bool mesh_name_matches (const std::string& name, const char* path)
+{
+	if (name == path)
+		return true;
+	const char* slash = strrchr(path, '/');
+	return slash != nullptr && name == slash + 1;
+}
+
+mesh_optimize_level_t mesh_optimize_level_for (const char* mesh_path)
+{
+	mesh_optimize_level_t default_level = MESH_OPTIMIZE_FULL;
+	if (app_mesh_optimize == nullptr)
+		return default_level;
+
+	const std::string list = app_mesh_optimize;
+	size_t begin = 0;
+	while (begin <= list.size()) {
+		size_t end = list.find(',', begin);
+		if (end == std::string::npos)
+			end = list.size();
+		const std::string entry = list.substr(begin, end - begin);
+		begin = end + 1;
+
+		const size_t colon = entry.rfind(':');
+		if (colon == std::string::npos) {
+			default_level = parse_level(entry);
+		} else if (mesh_name_matches(entry.substr(0, colon), mesh_path)) {
+			return parse_level(entry.substr(colon + 1));
+		}
+	}
+	return default_level;
+}
+
+/* ================ CACHE SIMULATION ================ */
+
+/*
+ * A FIFO cache where a vertex is cached if it was missed
+ * fewer than `size` misses ago
+ */
+struct fifo_cache_t {
+	std::vector<uint32_t> miss_time;
+	uint32_t time;
+	uint32_t size;
+
+	fifo_cache_t (int num_vertices, int cache_size)
+		: miss_time(num_vertices, 0), time(cache_size + 1), size(cache_size) { }
+
+	/* Returns whether it was a miss */
+	bool access (uint32_t v)
+	{
+		if (time - miss_time[v] <= size)
+			return false;
+		miss_time[v] = time++;
+		return true;
+	}
+
+	void flush ()
+	{
+		time += size + 1;
+	}
+};
+
+mesh_cache_stats_t mesh_cache_stats (const mesh_data_t& mesh, int cache_size)
+{
+	fifo_cache_t cache(mesh.vertices.size(), cache_size);
+	std::vector<bool> used(mesh.vertices.size(), false);
+
+	int misses = 0;
+	int num_used = 0;
+	for (uint32_t v: mesh.indices) {
+		misses += cache.access(v);
+		if (!used[v]) {
+			used[v] = true;
+			num_used++;
+		}
+	}
+
+	const int num_triangles = mesh.indices.size() / 3;
+	return { num_triangles ? (float) misses / num_triangles : 0.0f,
+	         num_used ? (float) misses / num_used : 0.0f };
+}
+
+/* ================ VERTEX CACHE ================ */
+
+namespace forsyth
+{
+constexpr float CACHE_DECAY_POWER = 1.5;
+constexpr float LAST_TRI_SCORE = 0.75;
+constexpr float VALENCE_BOOST_SCALE = 2.0;
+constexpr float VALENCE_BOOST_POWER = 0.5;
+constexpr int MAX_TABLED_VALENCE = 64;
+
+struct score_tables_t {
+	float cache[CACHE_SIZE];
+	float valence[MAX_TABLED_VALENCE];
+
+	score_tables_t ()
+	{
+		for (int i = 0; i < CACHE_SIZE; i++) {
+			cache[i] = (i < 3) ? LAST_TRI_SCORE
+			         : std::pow(1.0f - (i - 3) / float(CACHE_SIZE - 3),
+			                    CACHE_DECAY_POWER);
+		}
+		valence[0] = 0.0;
+		for (int i = 1; i < MAX_TABLED_VALENCE; i++)
+			valence[i] = VALENCE_BOOST_SCALE * std::pow(i, -VALENCE_BOOST_POWER);
+	}
+};
+static const score_tables_t tables;
+
+static float vertex_score (int cache_pos, int num_live_triangles)
+{
+	if (num_live_triangles == 0)
+		return -1.0;
+
+	float score = (cache_pos >= 0) ? tables.cache[cache_pos] : 0.0f;
+	if (num_live_triangles < MAX_TABLED_VALENCE)
+		score += tables.valence[num_live_triangles];
+	else
+		score += VALENCE_BOOST_SCALE * std::pow(num_live_triangles, -VALENCE_BOOST_POWER);
+	return score;
+}
+} /* namespace forsyth */
+
+/*
+ * Renumbers the vertices used by a range of indices as 0, 1, 2...
+ * local[] must be all NONE for the vertices of the range,
+ * and it is left like that afterwards
+ */
+static int localize_vertices (const uint32_t* indices, int num_indices,
+		std::vector<uint32_t>& local, std::vector<uint32_t>& out)
+{
+	int num_local = 0;
+	out.resize(num_indices);
+	for (int i = 0; i < num_indices; i++) {
+		uint32_t& l = local[indices[i]];
+		if (l == NONE)
+			l = num_local++;
+		out[i] = l;
+	}
+	for (int i = 0; i < num_indices; i++)
+		local[indices[i]] = NONE;
+	return num_local;
+}
+
+static void optimize_vertex_cache (uint32_t* indices, int num_indices,
+		std::vector<uint32_t>& local_scratch)
+{
+	using namespace forsyth;
+	const int num_triangles = num_indices / 3;
+	if (num_triangles < 2)
+		return;
+
+	std::vector<uint32_t> tri_verts;
+	const int num_verts = localize_vertices(indices, num_indices,
+	                                        local_scratch, tri_verts);
+
+	/* Triangles using each vertex; the first `live` are not yet emitted */
+	std::vector<int> live(num_verts, 0);
+	for (uint32_t v: tri_verts)
+		live[v]++;
+	std::vector<int> adj_offset(num_verts + 1, 0);
+	for (int v = 0; v < num_verts; v++)
+		adj_offset[v + 1] = adj_offset[v] + live[v];
+	std::vector<int> adj(num_indices);
+	{
+		std::vector<int> fill(adj_offset.begin(), adj_offset.end() - 1);
+		for (int i = 0; i < num_indices; i++)
+			adj[fill[tri_verts[i]]++] = i / 3;
+	}
+
+	std::vector<int> cache_pos(num_verts, -1);
+	std::vector<float> vscore(num_verts);
+	for (int v = 0; v < num_verts; v++)
+		vscore[v] = vertex_score(-1, live[v]);
+
+	std::vector<float> tscore(num_triangles);
+	std::vector<bool> emitted(num_triangles, false);
+	int best = 0;
+	for (int t = 0; t < num_triangles; t++) {
+		const uint32_t* tv = &tri_verts[3 * t];
+		tscore[t] = vscore[tv[0]] + vscore[tv[1]] + vscore[tv[2]];
+		if (tscore[t] > tscore[best])
+			best = t;
+	}
+
+	/* Room for the triangle just emitted pushing a full cache */
+	uint32_t cache[CACHE_SIZE + 3];
+	uint32_t new_cache[CACHE_SIZE + 3];
+	int cache_len = 0;
+
+	std::vector<uint32_t> order;
+	order.reserve(num_triangles);
+	int cursor = 0;
+
+	while (order.size() < num_triangles) {
+		if (best < 0) {
+			/* Nothing in the cache connects anywhere; start afresh */
+			while (emitted[cursor])
+				cursor++;
+			best = cursor;
+		}
+
+		order.push_back(best);
+		emitted[best] = true;
+		const uint32_t* tv = &tri_verts[3 * best];
+
+		int new_len = 0;
+		for (int k = 0; k < 3; k++) {
+			const uint32_t v = tv[k];
+			int* list = &adj[adj_offset[v]];
+			int* pos = std::find(list, list + live[v], best);
+			std::swap(*pos, list[live[v] - 1]);
+			live[v]--;
+			new_cache[new_len++] = v;
+		}
+		for (int i = 0; i < cache_len; i++) {
+			const uint32_t v = cache[i];
+			if (v != tv[0] && v != tv[1] && v != tv[2])
+				new_cache[new_len++] = v;
+		}
+
+		/* What got pushed out past the cache size is evicted */
+		for (int i = 0; i < new_len; i++) {
+			const uint32_t v = new_cache[i];
+			cache_pos[v] = (i < CACHE_SIZE) ? i : -1;
+			vscore[v] = vertex_score(cache_pos[v], live[v]);
+		}
+		cache_len = std::min(new_len, CACHE_SIZE);
+		memcpy(cache, new_cache, cache_len * sizeof(cache[0]));
+
+		best = -1;
+		float best_score = -1.0;
+		for (int i = 0; i < cache_len; i++) {
+			const uint32_t v = cache[i];
+			for (int j = 0; j < live[v]; j++) {
+				const int t = adj[adj_offset[v] + j];
+				const uint32_t* w = &tri_verts[3 * t];
+				tscore[t] = vscore[w[0]] + vscore[w[1]] + vscore[w[2]];
+				if (tscore[t] > best_score) {
+					best_score = tscore[t];
+					best = t;
+				}
+			}
+		}
+	}
+
+	std::vector<uint32_t> reordered(num_indices);
+	for (int i = 0; i < num_triangles; i++)
+		memcpy(&reordered[3 * i], &indices[3 * order[i]], 3 * sizeof(uint32_t));
+	memcpy(indices, reordered.data(), num_indices * sizeof(uint32_t));
+}
+
+/* ================ OVERDRAW ================ */
+
+static void optimize_overdraw (const std::vector<mesh_vertex_t>& vertices,
+		uint32_t* indices, int num_indices)
+{
+	const int num_triangles = num_indices / 3;
+	if (num_triangles < 2)
+		return;
+
+	fifo_cache_t cache(vertices.size(), FIFO_CACHE_SIZE);
+
+	/* Where a triangle misses on all vertices, the cache flushed itself */
+	std::vector<uint8_t> misses(num_triangles);
+	int total_misses = 0;
+	for (int t = 0; t < num_triangles; t++) {
+		for (int k = 0; k < 3; k++)
+			misses[t] += cache.access(indices[3 * t + k]);
+		total_misses += misses[t];
+	}
+	const float target_acmr = CLUSTER_ACMR_THRESHOLD * total_misses / num_triangles;
+
+	/*
+	 * Also cut wherever the cluster so far is about as cache-friendly as
+	 * the whole mesh, because restarting from a cold cache there won't
+	 * cost more than that on average
+	 */
+	std::vector<int> cluster_start;
+	cache.flush();
+	int cluster_misses = 0;
+	for (int t = 0; t < num_triangles; t++) {
+		const int cluster_tris = cluster_start.empty() ? 0 : t - cluster_start.back();
+		if (t == 0 || misses[t] == 3
+		 || (cluster_tris > 0 && cluster_misses <= target_acmr * cluster_tris)) {
+			cluster_start.push_back(t);
+			cache.flush();
+			cluster_misses = 0;
+		}
+		for (int k = 0; k < 3; k++)
+			cluster_misses += cache.access(indices[3 * t + k]);
+	}
+	const int num_clusters = cluster_start.size();
+	cluster_start.push_back(num_triangles);
+
+	/* Area-weighted centroids and normals */
+	std::vector<vec3> centroid(num_clusters, vec3(0.0));
+	std::vector<vec3> normal(num_clusters, vec3(0.0));
+	std::vector<float> area(num_clusters, 0.0);
+	vec3 mesh_centroid(0.0);
+	float mesh_area = 0.0;
+
+	for (int c = 0; c < num_clusters; c++) {
+		for (int t = cluster_start[c]; t < cluster_start[c + 1]; t++) {
+			const vec3 p0 = vertices[indices[3 * t + 0]].position;
+			const vec3 p1 = vertices[indices[3 * t + 1]].position;
+			const vec3 p2 = vertices[indices[3 * t + 2]].position;
+			const vec3 n = glm::cross(p1 - p0, p2 - p0);
+			const float a = glm::length(n);
+			centroid[c] += a * (p0 + p1 + p2) / 3.0f;
+			normal[c] += n;
+			area[c] += a;
+		}
+		mesh_centroid += centroid[c];
+		mesh_area += area[c];
+	}
+	if (mesh_area > 0.0)
+		mesh_centroid /= mesh_area;
+
+	/* Clusters facing away from the middle are likely in front: draw first */
+	std::vector<std::pair<float, int>> keys(num_clusters);
+	for (int c = 0; c < num_clusters; c++) {
+		float key = 0.0;
+		if (area[c] > 0.0 && normal[c] != vec3(0.0)) {
+			key = glm::dot(centroid[c] / area[c] - mesh_centroid,
+			               glm::normalize(normal[c]));
+		}
+		keys[c] = { -key, c };
+	}
+	std::stable_sort(keys.begin(), keys.end(),
+			[] (const auto& a, const auto& b) { return a.first < b.first; });
+
+	std::vector<uint32_t> reordered;
+	reordered.reserve(num_indices);
+	for (const auto& [key, c]: keys) {
+		reordered.insert(reordered.end(),
+		                 indices + 3 * cluster_start[c],
+		                 indices + 3 * cluster_start[c + 1]);
+	}
+	memcpy(indices, reordered.data(), num_indices * sizeof(uint32_t));
+}
+
+/* ================ VERTEX FETCH ================ */
+
+static void optimize_vertex_fetch (mesh_data_t& mesh)
+{
+	const int num_vertices = mesh.vertices.size();
+	std::vector<uint32_t> remap(num_vertices, NONE);
+	uint32_t next = 0;
+
+	for (uint32_t& i: mesh.indices) {
+		if (remap[i] == NONE)
+			remap[i] = next++;
+		i = remap[i];
+	}
+	/* Not that there should be any unused ones */
+	for (uint32_t& r: remap) {
+		if (r == NONE)
+			r = next++;
+	}
+
+	std::vector<mesh_vertex_t> reordered(num_vertices);
+	for (int v = 0; v < num_vertices; v++)
+		reordered[remap[v]] = mesh.vertices[v];
+	mesh.vertices = std::move(reordered);
+}
+
+void mesh_optimize (mesh_data_t& mesh, mesh_optimize_level_t level, const char* name)
+{
+	if (level == MESH_OPTIMIZE_NONE)
+		return;
+
+	const double t_start = time_seconds();
+	const mesh_cache_stats_t before = mesh_cache_stats(mesh, FIFO_CACHE_SIZE);
+
+	std::vector<uint32_t> local_scratch(mesh.vertices.size(), NONE);
+	for (const submesh_t& s: mesh.submeshes) {
+		uint32_t* indices = mesh.indices.data() + s.first_index;
+		optimize_vertex_cache(indices, s.num_indices, local_scratch);
+		if (level == MESH_OPTIMIZE_FULL)
+			optimize_overdraw(mesh.vertices, indices, s.num_indices);
+	}
+	optimize_vertex_fetch(mesh);
+
+	const mesh_cache_stats_t after = mesh_cache_stats(mesh, FIFO_CACHE_SIZE);
+	info("Mesh %s: optimized (%s) in %.1f ms, "
+	     "ACMR %.3f -> %.3f, ATVR %.3f -> %.3f (%i-entry FIFO)",
+	     name, level_names[level], (time_seconds() - t_start) * 1e3,
+	     before.acmr, after.acmr, before.atvr, after.atvr, FIFO_CACHE_SIZE);
+}
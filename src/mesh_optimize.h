@@ -0,0 +1,47 @@
+#ifndef MESH_OPTIMIZE_H
+#define MESH_OPTIMIZE_H
+
+#include "mesh.h"
+
+/*
+ * Reordering of imported meshes for faster drawing, done once at import
+ * (the result is what goes into the mesh cache):
+ *   - triangles are reordered for the post-transform vertex cache
+ *     (Forsyth's "linear-speed vertex cache optimisation");
+ *   - the result is cut into clusters where the cache gets flushed anyway,
+ *     and outward-facing clusters are moved first to cut down on overdraw
+ *     (as in Sander, Nehab, Barczak "Fast triangle reordering...");
+ *   - vertices are renumbered in the order they're first used, so that
+ *     fetching them walks through memory linearly.
+ * Each step only moves things within a submesh.
+ */
+
+enum mesh_optimize_level_t {
+	MESH_OPTIMIZE_NONE,
+	MESH_OPTIMIZE_CACHE, /* vertex cache + vertex fetch */
+	MESH_OPTIMIZE_FULL,  /* vertex cache + overdraw + vertex fetch */
+};
+
+/*
+ * From --mesh-optimize: a comma-separated list of levels, each
+ * optionally prefixed with "<mesh file>:" to only apply to that mesh.
+ * A level without a prefix is the default, which is otherwise "full".
+ * e.g. --mesh-optimize=cache,car.obj:full,scan.obj:none
+ */
+extern const char* app_mesh_optimize;
+mesh_optimize_level_t mesh_optimize_level_for (const char* mesh_path);
+
+/* `name` is only for the report of how much it helped */
+void mesh_optimize (mesh_data_t& mesh, mesh_optimize_level_t level, const char* name);
+
+/*
+ * Average cache miss ratio (misses per triangle) and average transform
+ * to vertex ratio (misses per vertex), for a FIFO cache of that size
+ */
+struct mesh_cache_stats_t {
+	float acmr;
+	float atvr;
+};
+mesh_cache_stats_t mesh_cache_stats (const mesh_data_t& mesh, int cache_size);
+
+#endif /* MESH_OPTIMIZE_H */
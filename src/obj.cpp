@@ -0,0 +1,684 @@
+#include "obj.h"
+#include "job.h"
+#include "mapped_file.h"
+#include "util.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string_view>
+
+/* Don't bother splitting the file finer than this */
+static constexpr size_t MIN_CHUNK_SIZE = 1 << 20;
+/* More chunks than threads, so that an unlucky slow chunk doesn't stall */
+static constexpr int CHUNKS_PER_THREAD = 8;
+static constexpr int MAX_REPORTED_BAD_LINES = 10;
+
+/* Records of a kind that isn't supported, like mtllib or usemtl */
+struct obj_unknown_keyword_t {
+	std::string keyword;
+	int count;
+};
+
+/* Everything parsed out of one line-aligned piece of the file */
+struct obj_chunk_t {
+	const char* begin;
+	const char* end;
+
+	std::vector<vec3> positions;
+	std::vector<vec3> normals;
+	std::vector<vec2> tex_coords;
+	std::vector<obj_corner_t> corners;
+
+	/*
+	 * Negative indices count back from the last vertex read so far, which
+	 * for a chunk is only known once all the preceding ones are parsed.
+	 * They are resolved against the chunk's own vertex counts, and these
+	 * (corner index * 3 + component) have the preceding counts added later
+	 */
+	std::vector<int> relative_refs;
+
+	/* first_triangle is relative to the chunk */
+	std::vector<obj_object_t> objects;
+	std::vector<obj_smoothing_t> smoothing;
+
+	std::vector<const char*> bad_lines;
+	/* Each kind once, in the order they first appear */
+	std::vector<obj_unknown_keyword_t> unknown_keywords;
+	/* First triangle (global) referring to a nonexistent vertex, or -1 */
+	int bad_triangle = -1;
+};
+
+/* A face corner as it's being parsed, before it's known to be valid */
+struct obj_face_corner_t {
+	obj_corner_t corner;
+	uint8_t relative_mask;
+};
+
+static int& corner_component (obj_corner_t& c, int component)
+{
+	switch (component) {
+	case 0:
+		return c.position;
+	case 1:
+		return c.tex_coord;
+	default:
+		return c.normal;
+	}
+}
+
+/* ================ NUMBER PARSING ================ */
+
+/*
+ * strtof() is locale-dependent, wants a terminating character past the
+ * number (which a mapped file doesn't have) and is slow. These only
+ * accept what OBJ exporters actually write and fall back otherwise
+ */
+
+static bool is_digit (char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static bool is_space (char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static const char* skip_spaces (const char* p, const char* end)
+{
+	while (p < end && is_space(*p))
+		p++;
+	return p;
+}
+
+static bool parse_float_slow (const char*& p, const char* end, float& out)
+{
+	char buf[64];
+	size_t len = 0;
+	while (p + len < end && len < sizeof(buf) - 1 && !is_space(p[len]))
+		len++;
+	memcpy(buf, p, len);
+	buf[len] = '\0';
+
+	char* num_end;
+	out = strtof(buf, &num_end);
+	if (num_end == buf)
+		return false;
+	p += num_end - buf;
+	return true;
+}
+
+static bool parse_float (const char*& p, const char* end, float& out)
+{
+	/* Powers of ten that are exact in a double */
+	static constexpr double pow10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+		1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+		1e21, 1e22 };
+	constexpr int max_pow10 = sizeof(pow10) / sizeof(pow10[0]) - 1;
+	/* Past this, more digits don't fit in the 53 bits of a double anyway */
+	constexpr uint64_t max_mantissa = (uint64_t{1} << 53) / 10;
+
+	const char* s = p;
+	bool negative = false;
+	if (s < end && (*s == '-' || *s == '+')) {
+		negative = (*s == '-');
+		s++;
+	}
+
+	uint64_t mantissa = 0;
+	int exponent = 0;
+	bool any_digits = false;
+
+	for (; s < end && is_digit(*s); s++) {
+		any_digits = true;
+		if (mantissa < max_mantissa)
+			mantissa = mantissa * 10 + (*s - '0');
+		else
+			exponent++;
+	}
+	if (s < end && *s == '.') {
+		s++;
+		for (; s < end && is_digit(*s); s++) {
+			any_digits = true;
+			if (mantissa < max_mantissa) {
+				mantissa = mantissa * 10 + (*s - '0');
+				exponent--;
+			}
+		}
+	}
+
+	if (!any_digits)
+		return parse_float_slow(p, end, out);
+
+	if (s < end && (*s == 'e' || *s == 'E')) {
+		const char* e = s + 1;
+		bool exp_negative = false;
+		if (e < end && (*e == '-' || *e == '+')) {
+			exp_negative = (*e == '-');
+			e++;
+		}
+		if (e < end && is_digit(*e)) {
+			int exp_value = 0;
+			for (; e < end && is_digit(*e); e++) {
+				if (exp_value < 10000)
+					exp_value = exp_value * 10 + (*e - '0');
+			}
+			exponent += exp_negative ? -exp_value : exp_value;
+			s = e;
+		}
+	}
+
+	double value = mantissa;
+	if (exponent < 0 && exponent >= -max_pow10)
+		value /= pow10[-exponent];
+	else if (exponent > 0 && exponent <= max_pow10)
+		value *= pow10[exponent];
+	else if (exponent != 0)
+		value *= std::pow(10.0, exponent);
+
+	out = negative ? -value : value;
+	p = s;
+	return true;
+}
+
+static bool parse_int (const char*& p, const char* end, int& out)
+{
+	const char* s = p;
+	bool negative = false;
+	if (s < end && (*s == '-' || *s == '+')) {
+		negative = (*s == '-');
+		s++;
+	}
+	if (s == end || !is_digit(*s))
+		return false;
+
+	int64_t value = 0;
+	for (; s < end && is_digit(*s); s++) {
+		value = value * 10 + (*s - '0');
+		if (value > INT32_MAX)
+			return false;
+	}
+
+	out = negative ? -value : value;
+	p = s;
+	return true;
+}
+
+/* ================ RECORD PARSING ================ */
+
+/* Whether the line starts with the keyword followed by whitespace or end */
+static bool line_keyword (const char*& p, const char* end, const char* kw)
+{
+	const size_t len = strlen(kw);
+	if (end - p < len || memcmp(p, kw, len) != 0)
+		return false;
+	if (p + len < end && !is_space(p[len]))
+		return false;
+	p += len;
+	return true;
+}
+
+template <int N>
+static bool parse_vec (const char* p, const char* end,
+		glm::vec<N, float>& v, int num_required)
+{
+	for (int i = 0; i < N; i++) {
+		p = skip_spaces(p, end);
+		if (p == end && i >= num_required) {
+			v[i] = 0.0;
+			continue;
+		}
+		if (!parse_float(p, end, v[i]))
+			return false;
+		if (p < end && !is_space(*p))
+			return false;
+	}
+	/* Anything after that is the optional w, which we ignore */
+	return true;
+}
+
+/* OBJ indices are 1-based, and negative ones count back from the end */
+static bool parse_index (const char*& p, const char* end,
+		int num_so_far, int& index, bool& relative)
+{
+	int raw;
+	if (!parse_int(p, end, raw) || raw == 0)
+		return false;
+
+	relative = (raw < 0);
+	index = relative ? num_so_far + raw : raw - 1;
+	return true;
+}
+
+static bool parse_face (const char* p, const char* end,
+		obj_chunk_t& chunk, std::vector<obj_face_corner_t>& face)
+{
+	face.clear();
+	while (true) {
+		p = skip_spaces(p, end);
+		if (p == end)
+			break;
+
+		obj_face_corner_t fc = { { -1, -1, -1 }, 0 };
+		bool rel = false;
+
+		if (!parse_index(p, end, chunk.positions.size(), fc.corner.position, rel))
+			return false;
+		fc.relative_mask |= rel << 0;
+
+		if (p < end && *p == '/') {
+			p++;
+			if (p < end && *p != '/') {
+				if (!parse_index(p, end, chunk.tex_coords.size(),
+				                 fc.corner.tex_coord, rel))
+					return false;
+				fc.relative_mask |= rel << 1;
+			}
+			if (p < end && *p == '/') {
+				p++;
+				if (!parse_index(p, end, chunk.normals.size(),
+				                 fc.corner.normal, rel))
+					return false;
+				fc.relative_mask |= rel << 2;
+			}
+		}
+
+		if (p < end && !is_space(*p))
+			return false;
+		face.push_back(fc);
+	}
+
+	if (face.size() < 3)
+		return false;
+
+	auto emit = [&chunk] (const obj_face_corner_t& fc) {
+		const int index = chunk.corners.size();
+		chunk.corners.push_back(fc.corner);
+		for (int k = 0; k < 3; k++) {
+			if (fc.relative_mask & (1 << k))
+				chunk.relative_refs.push_back(index * 3 + k);
+		}
+	};
+
+	for (int i = 2; i < face.size(); i++) {
+		emit(face[0]);
+		emit(face[i - 1]);
+		emit(face[i]);
+	}
+	return true;
+}
+
+static void count_unknown_keyword (obj_chunk_t& chunk, const char* p, const char* end)
+{
+	const char* kw_end = p;
+	while (kw_end < end && !is_space(*kw_end))
+		kw_end++;
+	const std::string_view kw(p, kw_end - p);
+
+	for (obj_unknown_keyword_t& u: chunk.unknown_keywords) {
+		if (u.keyword == kw) {
+			u.count++;
+			return;
+		}
+	}
+	chunk.unknown_keywords.push_back({ std::string(kw), 1 });
+}
+
+static void parse_chunk (obj_chunk_t& chunk)
+{
+	std::vector<obj_face_corner_t> face;
+	face.reserve(16);
+
+	const char* line = chunk.begin;
+	while (line < chunk.end) {
+		const char* line_end = (const char*)
+			memchr(line, '\n', chunk.end - line);
+		if (line_end == nullptr)
+			line_end = chunk.end;
+
+		const char* p = skip_spaces(line, line_end);
+		/* Trailing whitespace would only get in the way */
+		const char* end = line_end;
+		while (end > p && is_space(end[-1]))
+			end--;
+
+		bool ok = true;
+		const int num_triangles = chunk.corners.size() / 3;
+
+		if (p == end || *p == '#') {
+			/* Empty line or a comment */
+		} else if (line_keyword(p, end, "v")) {
+			vec3 v;
+			ok = parse_vec(p, end, v, 3);
+			if (ok)
+				chunk.positions.push_back(v);
+		} else if (line_keyword(p, end, "vn")) {
+			vec3 n;
+			ok = parse_vec(p, end, n, 3);
+			if (ok)
+				chunk.normals.push_back(n);
+		} else if (line_keyword(p, end, "vt")) {
+			vec2 t;
+			ok = parse_vec(p, end, t, 1);
+			if (ok)
+				chunk.tex_coords.push_back(t);
+		} else if (line_keyword(p, end, "f")) {
+			ok = parse_face(p, end, chunk, face);
+		} else if (line_keyword(p, end, "o")) {
+			p = skip_spaces(p, end);
+			chunk.objects.push_back({ std::string(p, end), num_triangles, 0 });
+		} else if (line_keyword(p, end, "s")) {
+			p = skip_spaces(p, end);
+			int group = 0;
+			if (!line_keyword(p, end, "off"))
+				ok = parse_int(p, end, group) && p == end && group >= 0;
+			if (ok)
+				chunk.smoothing.push_back({ num_triangles, group });
+		} else {
+			count_unknown_keyword(chunk, p, end);
+		}
+
+		if (!ok)
+			chunk.bad_lines.push_back(line);
+
+		line = line_end + 1;
+	}
+}
+
+/* ================ PUTTING IT TOGETHER ================ */
+
+static void split_into_chunks (const mapped_file_t& file,
+		int num_threads, std::vector<obj_chunk_t>& chunks)
+{
+	const char* const file_end = file.data + file.size;
+	const size_t chunk_size = std::max(MIN_CHUNK_SIZE,
+			file.size / (num_threads * CHUNKS_PER_THREAD) + 1);
+
+	const char* p = file.data;
+	while (p < file_end) {
+		const char* end = file_end;
+		if (file_end - p > chunk_size) {
+			end = (const char*) memchr(p + chunk_size, '\n',
+			                           file_end - p - chunk_size);
+			end = (end == nullptr) ? file_end : end + 1;
+		}
+
+		obj_chunk_t& c = chunks.emplace_back();
+		c.begin = p;
+		c.end = end;
+		p = end;
+	}
+}
+
+static void report_bad_lines (const char* path,
+		const mapped_file_t& file, const std::vector<obj_chunk_t>& chunks)
+{
+	int total = 0;
+	for (const obj_chunk_t& c: chunks)
+		total += c.bad_lines.size();
+	if (total == 0)
+		return;
+
+	/* Chunks are in file order, so the lines are sorted already */
+	int reported = 0;
+	int line_nr = 1;
+	const char* counted_up_to = file.data;
+	for (const obj_chunk_t& c: chunks) {
+		for (const char* line: c.bad_lines) {
+			if (reported == MAX_REPORTED_BAD_LINES)
+				break;
+			line_nr += std::count(counted_up_to, line, '\n');
+			counted_up_to = line;
+
+			const char* line_end = (const char*)
+				memchr(line, '\n', file.data + file.size - line);
+			int len = (line_end ? line_end : file.data + file.size) - line;
+			warning("%s:%i: skipping malformed line \"%.*s\"",
+					path, line_nr, std::min(len, 80), line);
+			reported++;
+		}
+	}
+
+	if (total > reported)
+		warning("%s: ...and %i more malformed lines", path, total - reported);
+}
+
+/* Once for each kind, however many chunks it's in */
+static void report_unknown_keywords (const char* path,
+		const std::vector<obj_chunk_t>& chunks)
+{
+	std::vector<obj_unknown_keyword_t> all;
+	for (const obj_chunk_t& c: chunks) {
+		for (const obj_unknown_keyword_t& u: c.unknown_keywords) {
+			auto it = std::find_if(all.begin(), all.end(),
+					[&u] (const obj_unknown_keyword_t& a) { return a.keyword == u.keyword; });
+			if (it != all.end())
+				it->count += u.count;
+			else
+				all.push_back(u);
+		}
+	}
+
+	for (const obj_unknown_keyword_t& u: all) {
+		warning("%s: skipping %i \"%.*s\" record(s), they aren't supported",
+				path, u.count, std::min((int) u.keyword.size(), 80), u.keyword.c_str());
+	}
+}
+
+obj_model_t obj_load (const char* path)
+{
+	const int num_threads = job_num_threads();
+
+	mapped_file_t file;
+	if (!file.open(path))
+		fatal("OBJ %s: cannot open file: %s", path, strerror(errno));
+
+	std::vector<obj_chunk_t> chunks;
+	split_into_chunks(file, num_threads, chunks);
+	const int num_chunks = chunks.size();
+
+	/* Chunks are big enough already to be a job each */
+	job_parallel_for(num_chunks, [&chunks] (int i) { parse_chunk(chunks[i]); }, 1);
+
+	report_bad_lines(path, file, chunks);
+	report_unknown_keywords(path, chunks);
+
+	/* Where each chunk's data ends up in the merged arrays */
+	struct chunk_base_t { int position, normal, tex_coord, corner; };
+	std::vector<chunk_base_t> bases(num_chunks);
+	chunk_base_t total = { 0, 0, 0, 0 };
+	for (int i = 0; i < num_chunks; i++) {
+		bases[i] = total;
+		total.position += chunks[i].positions.size();
+		total.normal += chunks[i].normals.size();
+		total.tex_coord += chunks[i].tex_coords.size();
+		total.corner += chunks[i].corners.size();
+	}
+
+	obj_model_t model;
+	model.positions.resize(total.position);
+	model.normals.resize(total.normal);
+	model.tex_coords.resize(total.tex_coord);
+	model.corners.resize(total.corner);
+
+	job_parallel_for(num_chunks, [&] (int i) {
+		obj_chunk_t& c = chunks[i];
+		const chunk_base_t& base = bases[i];
+
+		for (int ref: c.relative_refs) {
+			obj_corner_t& corner = c.corners[ref / 3];
+			const int component = ref % 3;
+			const int offset = (component == 0) ? base.position
+			                 : (component == 1) ? base.tex_coord
+			                                    : base.normal;
+			int& index = corner_component(corner, component);
+			index += offset;
+			/* Pointed before the start of the file */
+			if (index < 0)
+				index = INT32_MAX;
+		}
+
+		for (int k = 0; k < c.corners.size(); k++) {
+			const obj_corner_t& corner = c.corners[k];
+			if (corner.position < 0 || corner.position >= total.position
+			 || corner.tex_coord >= total.tex_coord
+			 || corner.normal >= total.normal) {
+				c.bad_triangle = (base.corner + k) / 3;
+				break;
+			}
+		}
+
+		std::copy(c.positions.begin(), c.positions.end(),
+		          model.positions.begin() + base.position);
+		std::copy(c.normals.begin(), c.normals.end(),
+		          model.normals.begin() + base.normal);
+		std::copy(c.tex_coords.begin(), c.tex_coords.end(),
+		          model.tex_coords.begin() + base.tex_coord);
+		std::copy(c.corners.begin(), c.corners.end(),
+		          model.corners.begin() + base.corner);
+
+		/* Free the memory early, these can be big */
+		c.positions = { };
+		c.normals = { };
+		c.tex_coords = { };
+		c.corners = { };
+	}, 1);
+
+	for (const obj_chunk_t& c: chunks) {
+		if (c.bad_triangle >= 0) {
+			fatal("OBJ %s: triangle %i refers to a vertex that "
+			      "doesn't exist", path, c.bad_triangle);
+		}
+	}
+
+	const int num_triangles = model.num_triangles();
+
+	/* Triangles before the first `o` go into an unnamed object */
+	model.objects.push_back({ "", 0, 0 });
+	model.smoothing.push_back({ 0, 0 });
+	for (int i = 0; i < num_chunks; i++) {
+		const int tri_base = bases[i].corner / 3;
+
+		for (obj_object_t& o: chunks[i].objects) {
+			o.first_triangle += tri_base;
+			model.objects.push_back(std::move(o));
+		}
+
+		for (obj_smoothing_t s: chunks[i].smoothing) {
+			s.first_triangle += tri_base;
+			obj_smoothing_t& last = model.smoothing.back();
+			if (s.first_triangle == last.first_triangle)
+				last.group = s.group;
+			else if (s.group != last.group)
+				model.smoothing.push_back(s);
+		}
+	}
+
+	std::vector<obj_object_t>& objs = model.objects;
+	for (int i = 0; i < objs.size(); i++) {
+		const int next = (i + 1 < objs.size())
+		               ? objs[i + 1].first_triangle
+		               : num_triangles;
+		objs[i].num_triangles = next - objs[i].first_triangle;
+	}
+	objs.erase(std::remove_if(objs.begin(), objs.end(),
+			[] (const obj_object_t& o) { return o.num_triangles == 0; }),
+			objs.end());
+
+	return model;
+}
+
+/* ================ BENCHMARK ================ */
+
+/* What loading looked like with the usual getline/istream approach */
+static int obj_load_istream_reference (const char* path)
+{
+	std::ifstream f(path);
+	std::vector<vec3> positions, normals;
+	std::vector<vec2> tex_coords;
+	std::vector<int> indices;
+
+	std::string line, keyword, token;
+	while (std::getline(f, line)) {
+		std::istringstream ss(line);
+		if (!(ss >> keyword))
+			continue;
+		if (keyword == "v") {
+			vec3 v;
+			ss >> v;
+			positions.push_back(v);
+		} else if (keyword == "vn") {
+			vec3 n;
+			ss >> n;
+			normals.push_back(n);
+		} else if (keyword == "vt") {
+			vec2 t;
+			ss >> t;
+			tex_coords.push_back(t);
+		} else if (keyword == "f") {
+			while (ss >> token)
+				indices.push_back(std::stoi(token));
+		}
+	}
+	return indices.size();
+}
+
+void obj_load_benchmark (int num_copies)
+{
+	constexpr const char* SOURCE_PATH = "car.obj";
+	constexpr int NUM_RUNS = 3;
+
+	num_copies = std::max(num_copies, 1);
+
+	mapped_file_t src;
+	if (!src.open(SOURCE_PATH))
+		fatal("Benchmark: cannot open %s: %s", SOURCE_PATH, strerror(errno));
+
+	const std::string path = (std::filesystem::temp_directory_path()
+	                          / "obj_load_benchmark.obj").string();
+	FILE* out = fopen(path.c_str(), "wb");
+	if (out == nullptr)
+		fatal("Benchmark: cannot create %s: %s", path.c_str(), strerror(errno));
+	for (int i = 0; i < num_copies; i++) {
+		fwrite(src.data, 1, src.size, out);
+		if (src.size > 0 && src.data[src.size - 1] != '\n')
+			fputc('\n', out);
+	}
+	fclose(out);
+
+	const double size_mib = (double) src.size * num_copies / (1 << 20);
+	printf("obj-load: %s x%i, %.1f MiB\n", SOURCE_PATH, num_copies, size_mib);
+
+	auto report = [size_mib] (const char* what, double seconds) {
+		printf("  %-24s %9.1f ms  %8.1f MiB/s\n",
+				what, seconds * 1e3, size_mib / seconds);
+	};
+
+	double t = time_seconds();
+	obj_load_istream_reference(path.c_str());
+	report("getline + istream", time_seconds() - t);
+
+	int num_triangles = 0;
+	job_for_each_thread_count([&] (int threads) {
+		double best = 1e30;
+		for (int run = 0; run < NUM_RUNS; run++) {
+			const double t_start = time_seconds();
+			obj_model_t m = obj_load(path.c_str());
+			best = std::min(best, time_seconds() - t_start);
+			num_triangles = m.num_triangles();
+		}
+
+		char what[64];
+		snprintf(what, sizeof(what), "obj_load, %i thread(s)", threads);
+		report(what, best);
+	});
+	printf("  %i triangles\n", num_triangles);
+
+	std::filesystem::remove(path);
+}
@@ -0,0 +1,61 @@
+#ifndef OBJ_H
+#define OBJ_H
+
+#include "math.h"
+#include <string>
+#include <vector>
+
+/*
+ * Wavefront OBJ import. Only the geometry is read: v, vn, vt, f, o and s
+ * records. Everything else (materials, groups, curves...) is skipped.
+ * Polygons are triangulated as fans.
+ *
+ * The file is memory-mapped and parsed in line-aligned chunks
+ * on several threads, which then get stitched together.
+ */
+
+/* Indices are 0-based, -1 means that the corner has no such attribute */
+struct obj_corner_t {
+	int position;
+	int tex_coord;
+	int normal;
+};
+
+struct obj_object_t {
+	std::string name;
+	int first_triangle;
+	int num_triangles;
+};
+
+/* A run of triangles in the same smoothing group. Group 0 is "off" */
+struct obj_smoothing_t {
+	int first_triangle;
+	int group;
+};
+
+struct obj_model_t {
+	std::vector<vec3> positions;
+	std::vector<vec3> normals;
+	std::vector<vec2> tex_coords;
+
+	/* Three per triangle */
+	std::vector<obj_corner_t> corners;
+
+	/* Both sorted by first_triangle and together cover all triangles */
+	std::vector<obj_object_t> objects;
+	std::vector<obj_smoothing_t> smoothing;
+
+	int num_triangles () const { return corners.size() / 3; }
+};
+
+/*
+ * Dies if the file can't be read or refers to vertices that don't exist.
+ * Records it doesn't understand are skipped, with a warning for each kind.
+ * Chunks are parsed as jobs, on as many threads as the job system has
+ */
+obj_model_t obj_load (const char* path);
+
+/* Loads car.obj replicated `num_copies` times, single- and multithreaded */
+void obj_load_benchmark (int num_copies);
+
+#endif /* OBJ_H */
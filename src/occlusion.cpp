@@ -0,0 +1,381 @@
+#include "occlusion.h"
+#include "job.h"
+#include "util.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define OCCLUSION_SSE
+#include <immintrin.h>
+#endif
+
+using ob = occlusion_buffer_t;
+
+/* ================ TRIANGLE SETUP ================ */
+
+/*
+ * A triangle ready to rasterize: three edge functions a*x + b*y + c,
+ * all >= 0 inside, and depth as a plane over the screen
+ */
+struct raster_tri_t {
+	float edge_a[3], edge_b[3], edge_c[3];
+	float z_a, z_b, z_c;
+	/* Pixel bounds, inclusive */
+	int min_x, min_y, max_x, max_y;
+};
+
+/* What one thread set up, with the triangles binned by tile */
+struct setup_bin_t {
+	std::vector<raster_tri_t> tris;
+	std::vector<uint32_t> tiles[ob::TILES_X * ob::TILES_Y];
+};
+
+/* Clip space to pixels, with depth in 0..1 */
+static vec3 to_screen (const vec4& clip)
+{
+	const vec3 ndc = vec3(clip) / clip.w;
+	return { (ndc.x * 0.5f + 0.5f) * ob::WIDTH,
+	         (ndc.y * 0.5f + 0.5f) * ob::HEIGHT,
+	         ndc.z * 0.5f + 0.5f };
+}
+
+/* Culled if facing away or covering no pixel centre */
+static bool setup_triangle (const vec3 v[3], raster_tri_t& t)
+{
+	const float area = (v[1].x - v[0].x) * (v[2].y - v[0].y)
+	                 - (v[1].y - v[0].y) * (v[2].x - v[0].x);
+	if (!(area > 0.0f))
+		return false;
+
+	/* Pixel centres inside */
+	t.min_x = std::max((int) ceilf(std::min({ v[0].x, v[1].x, v[2].x }) - 0.5f), 0);
+	t.min_y = std::max((int) ceilf(std::min({ v[0].y, v[1].y, v[2].y }) - 0.5f), 0);
+	t.max_x = std::min((int) floorf(std::max({ v[0].x, v[1].x, v[2].x }) - 0.5f), ob::WIDTH - 1);
+	t.max_y = std::min((int) floorf(std::max({ v[0].y, v[1].y, v[2].y }) - 0.5f), ob::HEIGHT - 1);
+	if (t.min_x > t.max_x || t.min_y > t.max_y)
+		return false;
+
+	/* Edge i is the one opposite vertex i, so it's also i's weight */
+	for (int i = 0; i < 3; i++) {
+		const vec3& p = v[(i + 1) % 3];
+		const vec3& q = v[(i + 2) % 3];
+		t.edge_a[i] = p.y - q.y;
+		t.edge_b[i] = q.x - p.x;
+		t.edge_c[i] = p.x * q.y - p.y * q.x;
+	}
+
+	t.z_a = t.z_b = t.z_c = 0.0f;
+	for (int i = 0; i < 3; i++) {
+		const float w = v[i].z / area;
+		t.z_a += t.edge_a[i] * w;
+		t.z_b += t.edge_b[i] * w;
+		t.z_c += t.edge_c[i] * w;
+	}
+	return true;
+}
+
+/*
+ * Only the near plane is clipped against; the rest is done by the
+ * pixel bounds. Up to 4 vertices come out
+ */
+static int clip_near (const vec4 in[3], vec4 out[4])
+{
+	int n = 0;
+	for (int i = 0; i < 3; i++) {
+		const vec4& a = in[i];
+		const vec4& b = in[(i + 1) % 3];
+		const float da = a.z + a.w;
+		const float db = b.z + b.w;
+		if (da >= 0.0f)
+			out[n++] = a;
+		if ((da >= 0.0f) != (db >= 0.0f))
+			out[n++] = a + (b - a) * (da / (da - db));
+	}
+	return n;
+}
+
+static void bin_triangle (setup_bin_t& bin, const raster_tri_t& t)
+{
+	const uint32_t index = bin.tris.size();
+	bin.tris.push_back(t);
+	for (int ty = t.min_y / ob::TILE_HEIGHT; ty <= t.max_y / ob::TILE_HEIGHT; ty++) {
+		for (int tx = t.min_x / ob::TILE_WIDTH; tx <= t.max_x / ob::TILE_WIDTH; tx++)
+			bin.tiles[ty * ob::TILES_X + tx].push_back(index);
+	}
+}
+
+static void setup_occluder (const occluder_t& occ, const mat4& view_proj, setup_bin_t& bin)
+{
+	const mat4 transform = view_proj * occ.model;
+	const std::vector<mesh_vertex_t>& vertices = occ.mesh->vertices;
+	const std::vector<uint32_t>& indices = occ.mesh->indices;
+
+	for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+		vec4 clip[3];
+		bool all_in_front = true;
+		for (int j = 0; j < 3; j++) {
+			clip[j] = transform * vec4(vertices[indices[i + j]].position, 1.0f);
+			all_in_front &= clip[j].z + clip[j].w >= 0.0f;
+		}
+
+		vec3 screen[4];
+		int n = 3;
+		if (all_in_front) {
+			for (int j = 0; j < 3; j++)
+				screen[j] = to_screen(clip[j]);
+		} else {
+			vec4 clipped[4];
+			n = clip_near(clip, clipped);
+			for (int j = 0; j < n; j++)
+				screen[j] = to_screen(clipped[j]);
+		}
+
+		/* A fan, if clipping made a quad */
+		for (int j = 1; j + 1 < n; j++) {
+			const vec3 tri[3] = { screen[0], screen[j], screen[j + 1] };
+			raster_tri_t t;
+			if (setup_triangle(tri, t))
+				bin_triangle(bin, t);
+		}
+	}
+}
+
+/* ================ RASTERIZATION ================ */
+
+static void raster_tile (float* depth, int tile_x0, int tile_y0, const raster_tri_t& t)
+{
+	const int x0 = std::max(t.min_x, tile_x0) & ~3;
+	const int x1 = std::min(t.max_x, tile_x0 + ob::TILE_WIDTH - 1);
+	const int y0 = std::max(t.min_y, tile_y0);
+	const int y1 = std::min(t.max_y, tile_y0 + ob::TILE_HEIGHT - 1);
+
+#ifdef OCCLUSION_SSE
+	/* 4 pixels of a row at a time */
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 step = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	__m128 a[3], b[3], c[3];
+	for (int i = 0; i < 3; i++) {
+		a[i] = _mm_set1_ps(t.edge_a[i]);
+		b[i] = _mm_set1_ps(t.edge_b[i]);
+		c[i] = _mm_set1_ps(t.edge_c[i]);
+	}
+	const __m128 za = _mm_set1_ps(t.z_a);
+	const __m128 zb = _mm_set1_ps(t.z_b);
+	const __m128 zc = _mm_set1_ps(t.z_c);
+
+	for (int y = y0; y <= y1; y++) {
+		const __m128 py = _mm_set1_ps(y + 0.5f);
+		float* row = depth + y * ob::WIDTH;
+		for (int x = x0; x <= x1; x += 4) {
+			const __m128 px = _mm_add_ps(_mm_set1_ps(x), step);
+			__m128 inside = _mm_cmpeq_ps(zero, zero);
+			for (int i = 0; i < 3; i++) {
+				const __m128 e = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[i], px),
+				                                       _mm_mul_ps(b[i], py)), c[i]);
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(e, zero));
+			}
+			const __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(za, px),
+			                                       _mm_mul_ps(zb, py)), zc);
+			const __m128 old = _mm_loadu_ps(row + x);
+			const __m128 nearer = _mm_min_ps(old, z);
+			_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer),
+			                                 _mm_andnot_ps(inside, old)));
+		}
+	}
+#else
+	for (int y = y0; y <= y1; y++) {
+		const float py = y + 0.5f;
+		float* row = depth + y * ob::WIDTH;
+		for (int x = x0; x <= x1; x++) {
+			const float px = x + 0.5f;
+			bool inside = true;
+			for (int i = 0; i < 3; i++)
+				inside &= t.edge_a[i] * px + t.edge_b[i] * py + t.edge_c[i] >= 0.0f;
+			if (inside)
+				row[x] = std::min(row[x], t.z_a * px + t.z_b * py + t.z_c);
+		}
+	}
+#endif
+}
+
+void occlusion_buffer_t::render (const std::vector<occluder_t>& occluders,
+		const mat4& view_proj_)
+{
+	const double t_start = time_seconds();
+	const int num_threads = job_num_threads();
+	view_proj = view_proj_;
+	depth.assign(WIDTH * HEIGHT, 1.0f);
+	block_max.resize(BLOCKS_X * BLOCKS_Y);
+
+	/* Each thread sets up and bins a share of the occluders */
+	const int num_bins = std::max(1, std::min<int>(num_threads, occluders.size()));
+	std::vector<setup_bin_t> bins(num_bins);
+	job_parallel_for(num_bins, [&] (int b) {
+		const size_t first = occluders.size() * b / num_bins;
+		const size_t end = occluders.size() * (b + 1) / num_bins;
+		for (size_t i = first; i < end; i++)
+			setup_occluder(occluders[i], view_proj, bins[b]);
+	});
+
+	/* Then each tile is rasterized by one thread, from all bins */
+	job_parallel_for(TILES_X * TILES_Y, [&] (int tile) {
+		const int tile_x0 = tile % TILES_X * TILE_WIDTH;
+		const int tile_y0 = tile / TILES_X * TILE_HEIGHT;
+		for (const setup_bin_t& bin: bins) {
+			for (uint32_t t: bin.tiles[tile])
+				raster_tile(depth.data(), tile_x0, tile_y0, bin.tris[t]);
+		}
+
+		for (int by = tile_y0 / BLOCK_SIZE; by < (tile_y0 + TILE_HEIGHT) / BLOCK_SIZE; by++) {
+			for (int bx = tile_x0 / BLOCK_SIZE; bx < (tile_x0 + TILE_WIDTH) / BLOCK_SIZE; bx++) {
+				float m = 0.0f;
+				for (int y = by * BLOCK_SIZE; y < (by + 1) * BLOCK_SIZE; y++) {
+					for (int x = bx * BLOCK_SIZE; x < (bx + 1) * BLOCK_SIZE; x++)
+						m = std::max(m, depth[y * WIDTH + x]);
+				}
+				block_max[by * BLOCKS_X + bx] = m;
+			}
+		}
+	});
+
+	stats.num_occluders = occluders.size();
+	stats.num_triangles = 0;
+	for (const setup_bin_t& bin: bins)
+		stats.num_triangles += bin.tris.size();
+	stats.render_ms = (time_seconds() - t_start) * 1e3;
+}
+
+/* ================ TESTING ================ */
+
+bool occlusion_buffer_t::box_visible (const aabb_t& box) const
+{
+	/* The screen rectangle of the corners, and the nearest of them */
+	vec2 lo(INFINITY), hi(-INFINITY);
+	float z_min = INFINITY;
+	for (int i = 0; i < 8; i++) {
+		const vec3 corner((i & 1 ? box.max : box.min).x,
+		                  (i & 2 ? box.max : box.min).y,
+		                  (i & 4 ? box.max : box.min).z);
+		const vec4 clip = view_proj * vec4(corner, 1.0f);
+		/* Crossing the near plane, and so right in front */
+		if (clip.z + clip.w < 0.0f || clip.w <= 0.0f)
+			return true;
+		const vec3 s = to_screen(clip);
+		lo = glm::min(lo, vec2(s));
+		hi = glm::max(hi, vec2(s));
+		z_min = std::min(z_min, s.z);
+	}
+
+	/* Every pixel the rectangle touches */
+	const int x0 = std::max((int) floorf(lo.x), 0);
+	const int y0 = std::max((int) floorf(lo.y), 0);
+	const int x1 = std::min((int) floorf(hi.x), WIDTH - 1);
+	const int y1 = std::min((int) floorf(hi.y), HEIGHT - 1);
+	if (x0 > x1 || y0 > y1)
+		return true;
+
+	for (int by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++) {
+		for (int bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++) {
+			/* All of the block is in front */
+			if (block_max[by * BLOCKS_X + bx] <= z_min)
+				continue;
+
+			const int px1 = std::min(x1, (bx + 1) * BLOCK_SIZE - 1);
+			const int py1 = std::min(y1, (by + 1) * BLOCK_SIZE - 1);
+			for (int y = std::max(y0, by * BLOCK_SIZE); y <= py1; y++) {
+				for (int x = std::max(x0, bx * BLOCK_SIZE); x <= px1; x++) {
+					if (depth[y * WIDTH + x] > z_min)
+						return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+
+void occlusion_buffer_t::cull (const cull_boxes_t& boxes, std::vector<uint32_t>& indices)
+{
+	constexpr int CHUNK_SIZE = 1024;
+	const double t_start = time_seconds();
+
+	const int n = indices.size();
+	std::vector<uint8_t> visible(n);
+	job_parallel_for((n + CHUNK_SIZE - 1) / CHUNK_SIZE, [&] (int chunk) {
+		const int end = std::min(n, (chunk + 1) * CHUNK_SIZE);
+		for (int i = chunk * CHUNK_SIZE; i < end; i++) {
+			const uint32_t b = indices[i];
+			const aabb_t box = { { boxes.min_x[b], boxes.min_y[b], boxes.min_z[b] },
+			                     { boxes.max_x[b], boxes.max_y[b], boxes.max_z[b] } };
+			visible[i] = box_visible(box);
+		}
+	});
+
+	int kept = 0;
+	for (int i = 0; i < n; i++) {
+		indices[kept] = indices[i];
+		kept += visible[i];
+	}
+	indices.resize(kept);
+
+	stats.num_tested = n;
+	stats.num_culled = n - kept;
+	stats.test_ms = (time_seconds() - t_start) * 1e3;
+}
+
+/* ================ BENCHMARK ================ */
+
+void occlusion_benchmark (int num_boxes)
+{
+	constexpr int NUM_FRAMES = 20;
+
+	/*
+	 * Blocks of houses along streets, each house an occluder, with
+	 * small things scattered among and behind them to be culled
+	 */
+	const mesh_data_t box = mesh_data_box();
+	const int num_houses = std::max(1, num_boxes / 10);
+	const int side = ceil(sqrt(num_houses));
+	std::vector<occluder_t> occluders;
+	for (int i = 0; i < num_houses; i++) {
+		const vec3 pos((i % side - side / 2) * 12.0f, (i / side - side / 2) * 12.0f, 0.0f);
+		const vec3 size(10.0f, 10.0f, 6.0f + i % 7);
+		mat4 model = glm::translate(mat4(1.0), pos + vec3(0, 0, size.z / 2));
+		occluders.push_back({ &box, glm::scale(model, size) });
+	}
+
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> coord(-side * 6.0f, side * 6.0f);
+	cull_boxes_t boxes;
+	for (int i = 0; i < num_boxes; i++) {
+		const vec3 min(coord(rng), coord(rng), 0.0f);
+		boxes.push_back({ min, min + vec3(1.0f) });
+	}
+
+	/* Down a street, just above the ground */
+	const mat4 view_proj = glm::perspective(glm::radians(70.0f), 2.0f, 0.5f, 2000.0f)
+		* glm::lookAt(vec3(-side * 6.0f, 6.0f, 2.0f), vec3(0.0f, 6.0f, 2.0f), vec3(0, 0, 1));
+
+	std::vector<uint32_t> in_frustum;
+	cull_frustum(frustum_from_matrix(view_proj), boxes, in_frustum);
+	printf("occlusion: %i occluders, %i boxes, %zu in the frustum\n",
+			num_houses, num_boxes, in_frustum.size());
+
+	job_for_each_thread_count([&] (int threads) {
+		occlusion_buffer_t buffer;
+		double render = 0.0, test = 0.0;
+		for (int frame = 0; frame < NUM_FRAMES; frame++) {
+			std::vector<uint32_t> visible = in_frustum;
+			buffer.render(occluders, view_proj);
+			buffer.cull(boxes, visible);
+			render += buffer.stats.render_ms;
+			test += buffer.stats.test_ms;
+		}
+		printf("  %2i threads: %u triangles, %u of %u culled, "
+				"%6.3f ms rendering, %6.3f ms testing\n",
+				threads, buffer.stats.num_triangles,
+				buffer.stats.num_culled, buffer.stats.num_tested,
+				render / NUM_FRAMES, test / NUM_FRAMES);
+	});
+}
@@ -0,0 +1,64 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include "cull.h"
+#include "math.h"
+#include "mesh.h"
+#include <cstdint>
+#include <vector>
+
+/* A mesh that hides what's behind it, as its CPU copy */
+struct occluder_t {
+	const mesh_data_t* mesh;
+	mat4 model;
+};
+
+struct occlusion_stats_t {
+	uint32_t num_occluders;
+	/* That faced the camera and were binned */
+	uint32_t num_triangles;
+	uint32_t num_tested;
+	uint32_t num_culled;
+	double render_ms;
+	double test_ms;
+};
+
+/*
+ * Software occlusion culling. Occluders are rasterized on the CPU into
+ * a small depth buffer, split into tiles that threads rasterize on their
+ * own after the triangles are binned to them. The maximum depth of each
+ * block of pixels is kept as well, so that boxes can be tested a block
+ * at a time and pixels are only looked at where the block is unsure.
+ *
+ * Depth goes from 0 at the near plane to 1 at the far one, and y up
+ */
+struct occlusion_buffer_t {
+	static constexpr int WIDTH = 256;
+	static constexpr int HEIGHT = 128;
+	static constexpr int TILE_WIDTH = 64;
+	static constexpr int TILE_HEIGHT = 32;
+	static constexpr int TILES_X = WIDTH / TILE_WIDTH;
+	static constexpr int TILES_Y = HEIGHT / TILE_HEIGHT;
+	static constexpr int BLOCK_SIZE = 8;
+	static constexpr int BLOCKS_X = WIDTH / BLOCK_SIZE;
+	static constexpr int BLOCKS_Y = HEIGHT / BLOCK_SIZE;
+
+	std::vector<float> depth;
+	/* Of each BLOCK_SIZE x BLOCK_SIZE block, the farthest depth */
+	std::vector<float> block_max;
+	mat4 view_proj;
+	occlusion_stats_t stats;
+
+	/* As jobs, binning a share of the occluders and then a tile each */
+	void render (const std::vector<occluder_t>& occluders, const mat4& view_proj);
+
+	/* Whether any of the box may be in front of the occluders */
+	bool box_visible (const aabb_t& box) const;
+	/* Leaves in `indices` only those of the boxes that may be visible */
+	void cull (const cull_boxes_t& boxes, std::vector<uint32_t>& indices);
+};
+
+/* --benchmark=occlusion: a city of that many boxes, seen from the street */
+void occlusion_benchmark (int num_boxes);
+
+#endif /* OCCLUSION_H */
@@ -0,0 +1,157 @@
+#include "render_thread.h"
+#include "util.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+bool app_render_thread = true;
+render_stats_t render_stats;
+
+static render_commands_t frames[2];
+/* The frame the main thread records; the render thread draws the other */
+static int recording;
+
+static std::thread render_thread;
+static std::mutex frame_mutex;
+static std::condition_variable frame_cond;
+/* These three are under the mutex */
+static bool frame_ready;
+static bool quit;
+static render_stats_t drawn_stats;
+
+/* Of the main thread, from where it handed the frame before over */
+static double t_main_start;
+
+static void draw_frame (const render_commands_t& f)
+{
+	gl_state_counters_last_frame = gl_state_counters;
+	gl_state_counters = { };
+	glsl_poll_programs();
+	mesh_poll_uploads();
+	scene_settings = f.scene_settings;
+
+	gl_viewport(0, 0, f.resolution_x, f.resolution_y);
+	glClearColor(0.0, 0.0, 0.0, 1.0);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	render_context.is_rendering = true;
+
+	f.viewport.render(f.resolution_y);
+
+	gui_render_frame(f.gui, f.resolution_x, f.resolution_y);
+
+	SDL_GL_SwapWindow(render_context.sdl_window);
+	render_context.is_rendering = false;
+
+	if (GLenum err = glGetError(); err != 0)
+		warning("OpenGL error: %i (0x%x)", err, err);
+}
+
+/* What's only to be read on the thread that draws */
+static void collect_stats (render_stats_t& st)
+{
+	st.gl_state = gl_state_counters;
+	st.scene_num_drawn = scene_num_drawn;
+	st.occlusion = scene_occlusion_stats;
+	st.mesh_arena = mesh_arena_stats();
+	st.shader_reload = glsl_reload_status;
+}
+
+static void render_loop ()
+{
+	SDL_GL_MakeCurrent(render_context.sdl_window, render_context.sdl_gl_context);
+
+	std::unique_lock<std::mutex> lock(frame_mutex);
+	double t_wait = time_seconds();
+	while (true) {
+		frame_cond.wait(lock, [] { return frame_ready || quit; });
+		if (!frame_ready)
+			break;
+		const render_commands_t& f = frames[1 - recording];
+		lock.unlock();
+
+		const double t_start = time_seconds();
+		draw_frame(f);
+		const double t_end = time_seconds();
+
+		render_stats_t st;
+		collect_stats(st);
+		st.timings.render_ms = (t_end - t_start) * 1e3;
+		st.timings.render_wait_ms = (t_start - t_wait) * 1e3;
+		t_wait = t_end;
+
+		lock.lock();
+		drawn_stats = st;
+		frame_ready = false;
+		frame_cond.notify_all();
+	}
+
+	SDL_GL_MakeCurrent(render_context.sdl_window, nullptr);
+}
+
+void render_thread_start ()
+{
+	t_main_start = time_seconds();
+	if (!app_render_thread)
+		return;
+
+	/* A context can only be current on one thread */
+	SDL_GL_MakeCurrent(render_context.sdl_window, nullptr);
+	quit = false;
+	render_thread = std::thread(render_loop);
+}
+
+void render_thread_stop ()
+{
+	if (render_thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(frame_mutex);
+			quit = true;
+		}
+		frame_cond.notify_all();
+		render_thread.join();
+		SDL_GL_MakeCurrent(render_context.sdl_window, render_context.sdl_gl_context);
+	}
+
+	for (render_commands_t& f: frames)
+		gui_free_draw_data(f.gui);
+}
+
+static void record_frame (render_commands_t& f)
+{
+	f.resolution_x = render_context.resolution_x;
+	f.resolution_y = render_context.resolution_y;
+	viewport.set_dimension(gui_viewport3d_pos, gui_viewport3d_size);
+	f.viewport = viewport;
+	f.scene_settings = gui_scene_settings;
+	gui_copy_draw_data(f.gui);
+}
+
+void render_submit_frame ()
+{
+	render_commands_t& f = frames[recording];
+	record_frame(f);
+	const double t_main_end = time_seconds();
+
+	if (!render_thread.joinable()) {
+		draw_frame(f);
+		const double t_end = time_seconds();
+		collect_stats(render_stats);
+		render_stats.timings = { (t_main_end - t_main_start) * 1e3, 0.0,
+		                         (t_end - t_main_end) * 1e3, 0.0 };
+		t_main_start = t_end;
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(frame_mutex);
+	frame_cond.wait(lock, [] { return !frame_ready; });
+	const double t_handed = time_seconds();
+
+	render_stats = drawn_stats;
+	render_stats.timings.main_ms = (t_main_end - t_main_start) * 1e3;
+	render_stats.timings.main_wait_ms = (t_handed - t_main_end) * 1e3;
+	t_main_start = t_handed;
+
+	recording = 1 - recording;
+	frame_ready = true;
+	frame_cond.notify_all();
+}
@@ -0,0 +1,61 @@
+#ifndef RENDER_THREAD_H
+#define RENDER_THREAD_H
+
+#include "app.h"
+#include "gl.h"
+#include "gl_glsl.h"
+#include "gui.h"
+#include "mesh.h"
+#include "scene.h"
+
+/* Off with --no-render-thread, to draw each frame on the main thread */
+extern bool app_render_thread;
+
+/*
+ * Everything a frame is drawn from, recorded by the main thread. There
+ * are two, so that the render thread draws one while the main thread
+ * records the next
+ */
+struct render_commands_t {
+	int resolution_x;
+	int resolution_y;
+	/* With the camera as it was */
+	viewport3d_t viewport;
+	scene_settings_t scene_settings;
+	gui_draw_data_t gui;
+};
+
+/* Of a frame, in milliseconds */
+struct frame_timings_t {
+	/* Input, updating and the GUI, then handing the frame over */
+	double main_ms;
+	double main_wait_ms;
+	/* Drawing and swapping, then waiting for the next frame */
+	double render_ms;
+	double render_wait_ms;
+};
+
+/* Of the last frame drawn, copied back for the main thread to show */
+struct render_stats_t {
+	frame_timings_t timings;
+	gl_state_counters_t gl_state;
+	uint32_t scene_num_drawn;
+	occlusion_stats_t occlusion;
+	mesh_arena_stats_t mesh_arena;
+	glsl_reload_status_t shader_reload;
+};
+extern render_stats_t render_stats;
+
+/* After everything that needs GL on the main thread is initialized */
+void render_thread_start ();
+/* Waits for the last frame, and gives the GL context back to the main thread */
+void render_thread_stop ();
+
+/*
+ * Records a frame from the app and the GUI, and hands it over. Waits
+ * while the render thread is still drawing the one before, or draws it
+ * right away without a render thread
+ */
+void render_submit_frame ();
+
+#endif /* RENDER_THREAD_H */
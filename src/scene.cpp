@@ -0,0 +1,457 @@
+#include "scene.h"
+#include "cull.h"
+#include "gl_camera.h"
+#include "gl_glsl.h"
+#include "util.h"
+#include <cmath>
+#include <cstdio>
+#include <numeric>
+#include <unordered_map>
+
+std::vector<scene_object_t> scene_objects;
+scene_settings_t scene_settings;
+uint32_t scene_num_drawn;
+occlusion_stats_t scene_occlusion_stats;
+
+/* The bounds of scene_objects, kept alongside them */
+static cull_boxes_t object_boxes;
+static std::vector<uint32_t> visible_objects;
+
+static occlusion_buffer_t occlusion;
+static std::vector<occluder_t> occluders;
+/* Of the objects not culled by the frustum, those that aren't occluders */
+static std::vector<uint32_t> occludees;
+
+/*
+ * The program of each draw mode, submitted when the mode is first drawn
+ * with. All of them are warmed up at the start, so that's quick
+ */
+static const glsl_permutation_t mode_permutations[] = {
+	{ "mesh.vert", "mesh.frag", {} },
+	{ "mesh.vert", "mesh.frag", { "INSTANCED" } },
+	{ "mesh.vert", "mesh.frag", { "MULTI_DRAW" }, GLSL_PROLOGUE_430 },
+};
+static glsl_program_t mode_programs[3];
+static bool mode_submitted[3];
+
+static glsl_program_t mode_program (scene_draw_mode_t mode)
+{
+	if (!mode_submitted[mode]) {
+		const glsl_permutation_t& p = mode_permutations[mode];
+		mode_programs[mode] = glsl_submit_program(p.vert_path, p.frag_path,
+				p.prologue, p.defines);
+		mode_submitted[mode] = true;
+	}
+	return mode_programs[mode];
+}
+
+/* The objects with the same mesh */
+struct instance_batch_t {
+	const mesh_t* mesh;
+	std::vector<mat4> models;
+
+	GLuint buffer;
+	/* Instances the buffer has room for */
+	uint32_t capacity;
+	/* The range of instances that changed since the buffer was updated */
+	uint32_t dirty_first;
+	uint32_t dirty_end;
+
+	/* The models of those not culled, when that's not all */
+	std::vector<mat4> visible_models;
+};
+
+static std::vector<instance_batch_t> instance_batches;
+static std::unordered_map<const mesh_t*, uint32_t> batch_of_mesh;
+/* Refilled each frame with the visible_models of all batches */
+static GLuint visible_instance_buffer;
+
+/* As glMultiDrawElementsIndirect wants them */
+struct draw_command_t {
+	uint32_t count;
+	uint32_t instance_count;
+	uint32_t first_index;
+	int32_t base_vertex;
+	uint32_t base_instance;
+};
+
+static GLuint command_buffer;
+/* Model matrices, in the same order as the commands */
+static GLuint model_buffer;
+
+/* Commands of one index type */
+struct draw_group_t {
+	GLenum index_type;
+	std::vector<draw_command_t> commands;
+	std::vector<mat4> models;
+};
+static draw_group_t draw_groups[] = { { GL_UNSIGNED_SHORT, {}, {} },
+                                     { GL_UNSIGNED_INT, {}, {} } };
+
+void scene_init ()
+{
+	std::vector<glsl_permutation_t> precompile;
+	for (int mode = 0; mode < 3; mode++) {
+		if (scene_draw_mode_supported((scene_draw_mode_t) mode))
+			precompile.push_back(mode_permutations[mode]);
+	}
+	glsl_precompile(precompile);
+	/* What's drawn with until the program of the mode is ready */
+	mode_program(SCENE_DRAW_PER_OBJECT);
+
+	visible_instance_buffer = gl_gen_buffer();
+
+	scene_settings.draw_mode = render_context.has_multi_draw_indirect ? SCENE_DRAW_MULTI
+	                                                                 : SCENE_DRAW_INSTANCED;
+	if (render_context.has_multi_draw_indirect) {
+		command_buffer = gl_gen_buffer();
+		model_buffer = gl_gen_buffer();
+	}
+}
+
+void scene_deinit ()
+{
+	for (int mode = 0; mode < 3; mode++) {
+		if (mode_submitted[mode])
+			glsl_delete_program(mode_programs[mode]);
+		mode_submitted[mode] = false;
+	}
+	gl_delete_buffer(visible_instance_buffer);
+	if (render_context.has_multi_draw_indirect) {
+		gl_delete_buffer(command_buffer);
+		gl_delete_buffer(model_buffer);
+	}
+}
+
+bool scene_draw_mode_supported (scene_draw_mode_t mode)
+{
+	return mode != SCENE_DRAW_MULTI || render_context.has_multi_draw_indirect;
+}
+
+static void mark_dirty (instance_batch_t& b, uint32_t instance)
+{
+	b.dirty_first = std::min(b.dirty_first, instance);
+	b.dirty_end = std::max(b.dirty_end, instance + 1);
+}
+
+uint32_t scene_add (const mesh_t* mesh, const mat4& model, bool occluder)
+{
+	if (occluder && mesh->cpu_copy.indices.empty())
+		fatal("Scene: an occluder's mesh has no CPU copy");
+
+	auto [it, is_new] = batch_of_mesh.try_emplace(mesh, instance_batches.size());
+	if (is_new)
+		instance_batches.push_back({ mesh, { }, 0, 0, ~0u, 0, { } });
+	instance_batch_t& b = instance_batches[it->second];
+
+	const uint32_t instance = b.models.size();
+	b.models.push_back(model);
+	mark_dirty(b, instance);
+
+	scene_objects.push_back({ mesh, model, aabb_transform(mesh->bounds, model),
+	                          it->second, instance, occluder });
+	object_boxes.push_back(scene_objects.back().bounds);
+	return scene_objects.size() - 1;
+}
+
+void scene_move (uint32_t object, const mat4& model)
+{
+	scene_object_t& obj = scene_objects[object];
+	obj.model = model;
+	obj.bounds = aabb_transform(obj.mesh->bounds, model);
+	object_boxes.set(object, obj.bounds);
+
+	instance_batch_t& b = instance_batches[obj.batch];
+	b.models[obj.instance] = model;
+	mark_dirty(b, obj.instance);
+}
+
+void scene_clear ()
+{
+	for (instance_batch_t& b: instance_batches) {
+		if (b.buffer != 0)
+			gl_delete_buffer(b.buffer);
+	}
+	instance_batches.clear();
+	batch_of_mesh.clear();
+	scene_objects.clear();
+	object_boxes.clear();
+}
+
+static draw_group_t& group_for (GLenum index_type)
+{
+	return draw_groups[index_type == GL_UNSIGNED_INT];
+}
+
+static void draw_per_object ()
+{
+	gl_use_program(glsl_program(mode_program(SCENE_DRAW_PER_OBJECT)));
+	mesh_arena_bind();
+	for (uint32_t i: visible_objects) {
+		const scene_object_t& obj = scene_objects[i];
+		glUniformMatrix4fv(0, 1, GL_FALSE, glm::value_ptr(obj.model));
+		mesh_draw(*obj.mesh);
+	}
+}
+
+/* Uploads what changed, or everything if the buffer had to grow */
+static void update_instances (instance_batch_t& b)
+{
+	const uint32_t n = b.models.size();
+	if (b.buffer == 0)
+		b.buffer = gl_gen_buffer();
+	gl_bind_buffer(GL_ARRAY_BUFFER, b.buffer);
+
+	if (n > b.capacity) {
+		b.capacity = ceil_po2(n);
+		glBufferData(GL_ARRAY_BUFFER, b.capacity * sizeof(mat4), nullptr, GL_DYNAMIC_DRAW);
+		b.dirty_first = 0;
+		b.dirty_end = n;
+	}
+	if (b.dirty_first < b.dirty_end) {
+		glBufferSubData(GL_ARRAY_BUFFER, b.dirty_first * sizeof(mat4),
+				(b.dirty_end - b.dirty_first) * sizeof(mat4),
+				b.models.data() + b.dirty_first);
+	}
+	b.dirty_first = ~0u;
+	b.dirty_end = 0;
+}
+
+/*
+ * Batches with all their objects visible are drawn from their own
+ * buffer. Of the rest, the models of the visible ones are streamed
+ */
+static void draw_instanced ()
+{
+	for (instance_batch_t& b: instance_batches)
+		b.visible_models.clear();
+	for (uint32_t i: visible_objects) {
+		const scene_object_t& obj = scene_objects[i];
+		instance_batches[obj.batch].visible_models.push_back(obj.model);
+	}
+
+	size_t num_streamed = 0;
+	for (const instance_batch_t& b: instance_batches) {
+		if (b.visible_models.size() < b.models.size())
+			num_streamed += b.visible_models.size();
+	}
+	if (num_streamed > 0) {
+		gl_bind_buffer(GL_ARRAY_BUFFER, visible_instance_buffer);
+		glBufferData(GL_ARRAY_BUFFER, num_streamed * sizeof(mat4), nullptr, GL_STREAM_DRAW);
+	}
+
+	gl_use_program(glsl_program(mode_program(SCENE_DRAW_INSTANCED)));
+	mesh_arena_bind(true);
+
+	size_t offset = 0;
+	for (instance_batch_t& b: instance_batches) {
+		const size_t n = b.visible_models.size();
+		if (n == 0)
+			continue;
+
+		if (n == b.models.size()) {
+			update_instances(b);
+			mesh_instance_attribs(b.buffer);
+		} else {
+			gl_bind_buffer(GL_ARRAY_BUFFER, visible_instance_buffer);
+			glBufferSubData(GL_ARRAY_BUFFER, offset, n * sizeof(mat4),
+					b.visible_models.data());
+			mesh_instance_attribs(visible_instance_buffer, offset);
+			offset += n * sizeof(mat4);
+		}
+		mesh_draw_instanced(*b.mesh, n);
+	}
+}
+
+static void draw_multi ()
+{
+	for (draw_group_t& g: draw_groups) {
+		g.commands.clear();
+		g.models.clear();
+	}
+	for (uint32_t i: visible_objects) {
+		const scene_object_t& obj = scene_objects[i];
+		const mesh_t& m = *obj.mesh;
+		draw_group_t& g = group_for(m.index_type);
+		g.commands.push_back({ m.num_indices, 1,
+		                       (uint32_t) (m.index_offset / mesh_index_size(m.index_type)),
+		                       m.base_vertex, 0 });
+		g.models.push_back(obj.model);
+	}
+
+	/* All groups go into the same buffers, one after the other */
+	size_t num_draws = 0;
+	for (const draw_group_t& g: draw_groups)
+		num_draws += g.commands.size();
+	if (num_draws == 0)
+		return;
+
+	gl_bind_buffer(GL_DRAW_INDIRECT_BUFFER, command_buffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, num_draws * sizeof(draw_command_t),
+			nullptr, GL_STREAM_DRAW);
+	gl_bind_buffer(GL_SHADER_STORAGE_BUFFER, model_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, num_draws * sizeof(mat4),
+			nullptr, GL_STREAM_DRAW);
+	size_t first = 0;
+	for (const draw_group_t& g: draw_groups) {
+		const size_t n = g.commands.size();
+		glBufferSubData(GL_DRAW_INDIRECT_BUFFER, first * sizeof(draw_command_t),
+				n * sizeof(draw_command_t), g.commands.data());
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, first * sizeof(mat4),
+				n * sizeof(mat4), g.models.data());
+		first += n;
+	}
+
+	gl_use_program(glsl_program(mode_program(SCENE_DRAW_MULTI)));
+	gl_bind_buffer_base(GL_SHADER_STORAGE_BUFFER, 0, model_buffer);
+	mesh_arena_bind();
+
+	first = 0;
+	for (const draw_group_t& g: draw_groups) {
+		if (g.commands.empty())
+			continue;
+		glUniform1i(1, first);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, g.index_type,
+				(void*) (first * sizeof(draw_command_t)),
+				g.commands.size(), 0);
+		first += g.commands.size();
+	}
+}
+
+/* Occluders first, then whatever they don't hide */
+static void cull_occluded (const mat4& view_proj)
+{
+	occluders.clear();
+	occludees.clear();
+	for (uint32_t i: visible_objects) {
+		const scene_object_t& obj = scene_objects[i];
+		if (obj.occluder)
+			occluders.push_back({ &obj.mesh->cpu_copy, obj.model });
+		else
+			occludees.push_back(i);
+	}
+	if (occluders.empty()) {
+		scene_occlusion_stats = { };
+		return;
+	}
+
+	occlusion.render(occluders, view_proj);
+	occlusion.cull(object_boxes, occludees);
+	scene_occlusion_stats = occlusion.stats;
+
+	size_t n = 0;
+	for (uint32_t i: visible_objects) {
+		if (scene_objects[i].occluder)
+			visible_objects[n++] = i;
+	}
+	visible_objects.resize(n);
+	visible_objects.insert(visible_objects.end(), occludees.begin(), occludees.end());
+}
+
+void scene_draw (const mat4& view_proj)
+{
+	if (scene_settings.culling) {
+		cull_frustum(frustum_from_matrix(view_proj), object_boxes, visible_objects);
+	} else {
+		visible_objects.resize(scene_objects.size());
+		std::iota(visible_objects.begin(), visible_objects.end(), 0);
+	}
+	if (scene_settings.occlusion_culling)
+		cull_occluded(view_proj);
+	scene_num_drawn = visible_objects.size();
+
+	/* Drawn per object, with the plainest program, until the others are compiled */
+	scene_draw_mode_t mode = scene_settings.draw_mode;
+	if (!glsl_program_ready(mode_program(mode)))
+		mode = SCENE_DRAW_PER_OBJECT;
+
+	switch (mode) {
+	case SCENE_DRAW_PER_OBJECT:
+		draw_per_object();
+		break;
+	case SCENE_DRAW_INSTANCED:
+		draw_instanced();
+		break;
+	case SCENE_DRAW_MULTI:
+		draw_multi();
+		break;
+	}
+}
+
+/* ================ BENCHMARK ================ */
+
+void scene_benchmark (int num_objects)
+{
+	constexpr int NUM_FRAMES = 20;
+
+	/* The app's scene, put aside */
+	std::vector<scene_object_t> app_objects;
+	cull_boxes_t app_boxes;
+	std::vector<instance_batch_t> app_batches;
+	std::unordered_map<const mesh_t*, uint32_t> app_batch_of_mesh;
+	auto swap_scenes = [&] () {
+		std::swap(app_objects, scene_objects);
+		std::swap(app_boxes, object_boxes);
+		std::swap(app_batches, instance_batches);
+		std::swap(app_batch_of_mesh, batch_of_mesh);
+	};
+	swap_scenes();
+	mesh_t box = mesh_upload(mesh_data_box());
+
+	/*
+	 * Boxes in a cube in front of the camera. Llvmpipe would spend all
+	 * the time in vertex shading with anything bigger than a box, and
+	 * a small viewport keeps rasterizing out of the way too
+	 */
+	const int side = ceil(cbrt(num_objects));
+	for (int i = 0; i < num_objects; i++) {
+		const vec3 pos(i % side, i / side % side, i / side / side);
+		scene_add(&box, glm::scale(glm::translate(mat4(1.0), pos * 2.0f), vec3(0.5)));
+	}
+	const mat4 view = glm::lookAt(vec3(-side), vec3(side), vec3(0, 0, 1));
+	const mat4 proj = glm::perspective(glm::radians(60.0f), 1.0f, 0.5f, 1000.0f);
+	const mat4 view_proj = proj * view;
+	gl_camera_upload(view, proj, vec2(64, 64));
+	gl_viewport(0, 0, 64, 64);
+	gl_enable(GL_DEPTH_TEST);
+
+	printf("scene: %i frames of %i objects\n", NUM_FRAMES, num_objects);
+	const scene_draw_mode_t app_mode = scene_settings.draw_mode;
+	const struct { scene_draw_mode_t mode; const char* name; } modes[] = {
+		{ SCENE_DRAW_PER_OBJECT, "a draw per object" },
+		{ SCENE_DRAW_INSTANCED, "instanced" },
+		{ SCENE_DRAW_MULTI, "multi-draw indirect" },
+	};
+	for (const auto& m: modes) {
+		if (!scene_draw_mode_supported(m.mode)) {
+			printf("  %s is not supported\n", m.name);
+			continue;
+		}
+		scene_settings.draw_mode = m.mode;
+		/* Rather than drawn per object while it compiles */
+		glsl_program(mode_program(m.mode));
+
+		/* Once so that nothing is done for the first time while measuring */
+		scene_draw(view_proj);
+		glFinish();
+
+		double submit = 0.0;
+		const double t_start = time_seconds();
+		for (int frame = 0; frame < NUM_FRAMES; frame++) {
+			const double t_frame = time_seconds();
+			scene_draw(view_proj);
+			submit += time_seconds() - t_frame;
+			glFinish();
+		}
+		const double total = time_seconds() - t_start;
+
+		printf("  %-24s %8.2f ms/frame submitting, %8.2f ms/frame in total, %u drawn\n",
+				m.name, submit * 1e3 / NUM_FRAMES, total * 1e3 / NUM_FRAMES,
+				scene_num_drawn);
+	}
+	scene_settings.draw_mode = app_mode;
+
+	scene_clear();
+	mesh_destroy(box);
+	swap_scenes();
+}
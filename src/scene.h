@@ -0,0 +1,82 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "math.h"
+#include "mesh.h"
+#include "occlusion.h"
+#include <vector>
+
+/*
+ * The static things in the world. Their meshes stay on the GPU and are
+ * shared between objects, so drawing the scene uploads no vertices,
+ * and binds nothing but the mesh arena
+ */
+struct scene_object_t {
+	const mesh_t* mesh;
+	mat4 model;
+	/* Of the mesh in world space */
+	aabb_t bounds;
+	/* Where its model matrix is among the instances of its mesh */
+	uint32_t batch;
+	uint32_t instance;
+	/* Drawn into the occlusion buffer, from the mesh's CPU copy */
+	bool occluder;
+};
+
+extern std::vector<scene_object_t> scene_objects;
+
+/* Loads the programs the scene is drawn with */
+void scene_init ();
+void scene_deinit ();
+
+/*
+ * Returns the object's index in scene_objects. Occluders need their
+ * mesh uploaded with a CPU copy
+ */
+uint32_t scene_add (const mesh_t* mesh, const mat4& model, bool occluder = false);
+void scene_move (uint32_t object, const mat4& model);
+void scene_clear ();
+
+enum scene_draw_mode_t {
+	/* A glDrawElements per object, with the transform as a uniform */
+	SCENE_DRAW_PER_OBJECT,
+	/*
+	 * A glDrawElementsInstanced per mesh; each mesh has a buffer of the
+	 * model matrices of its objects, updated only where they moved
+	 */
+	SCENE_DRAW_INSTANCED,
+	/*
+	 * GL 4.3: a glMultiDrawElementsIndirect per index type (the meshes
+	 * have no materials that would need anything else), with the model
+	 * matrices in a buffer
+	 */
+	SCENE_DRAW_MULTI,
+};
+bool scene_draw_mode_supported (scene_draw_mode_t mode);
+
+/* What can be changed about drawing while the app runs */
+struct scene_settings_t {
+	/* The best there is, unless changed */
+	scene_draw_mode_t draw_mode;
+	/* Leave out objects outside the view frustum */
+	bool culling = true;
+	/* Leave out objects hidden behind occluders. Occluders are always drawn */
+	bool occlusion_culling = true;
+};
+/* Those scene_draw goes by; with a render thread, only it touches them */
+extern scene_settings_t scene_settings;
+/* Objects drawn by the last scene_draw */
+extern uint32_t scene_num_drawn;
+/* Of the last scene_draw with occlusion culling */
+extern occlusion_stats_t scene_occlusion_stats;
+
+/*
+ * Culls by view_proj, so once per viewport. The camera block has to have
+ * been uploaded with the same matrices
+ */
+void scene_draw (const mat4& view_proj);
+
+/* --benchmark=scene: that many boxes, drawn each way */
+void scene_benchmark (int num_objects);
+
+#endif /* SCENE_H */
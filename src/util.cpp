@@ -1,4 +1,5 @@
 #include "util.h"
+#include <chrono>
 #include <cstdlib>
 #include <cstdarg>
 #include <cstdio>
@@ -28,6 +29,65 @@ void warning (const char* fmt, ...)
 	va_end(args);
 }
 
+void info (const char* fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	if (fmt)
+		vfprintf(stdout, fmt, args);
+	fputc('\n', stdout);
+	va_end(args);
+}
+
+double time_seconds ()
+{
+	using clock = std::chrono::steady_clock;
+	const auto t = clock::now().time_since_epoch();
+	return std::chrono::duration<double>(t).count();
+}
+
+uint64_t hash_bytes (const void* data, size_t size, uint64_t seed)
+{
+	constexpr uint64_t M1 = 0x9e3779b97f4a7c15;
+	constexpr uint64_t M2 = 0xbf58476d1ce4e5b9;
+	auto mix = [] (uint64_t h, uint64_t k) {
+		k *= M2;
+		k ^= k >> 31;
+		return (h ^ k) * M1;
+	};
+
+	const unsigned char* p = (const unsigned char*) data;
+	uint64_t h = seed ^ (size * M1);
+
+	/* Four independent lanes so that the multiplies can overlap */
+	uint64_t lanes[4] = { h, h + M1, h + M2, h - M1 };
+	for (; size >= 32; p += 32, size -= 32) {
+		for (int i = 0; i < 4; i++) {
+			uint64_t k;
+			memcpy(&k, p + 8 * i, 8);
+			lanes[i] = mix(lanes[i], k);
+		}
+	}
+	for (int i = 0; i < 4; i++)
+		h = mix(h, lanes[i]);
+
+	for (; size >= 8; p += 8, size -= 8) {
+		uint64_t k;
+		memcpy(&k, p, 8);
+		h = mix(h, k);
+	}
+	if (size > 0) {
+		uint64_t k = 0;
+		memcpy(&k, p, size);
+		h = mix(h, k);
+	}
+
+	h ^= h >> 33;
+	h *= M2;
+	h ^= h >> 29;
+	return h;
+}
+
 bool str_any_of (const char* needle,
 		std::initializer_list<const char*> haystack)
 {
@@ -1,6 +1,7 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <cstdint>
 #include <iostream>
 
 #define DEBUG_EXPR(expr) \
@@ -18,6 +19,11 @@
 
 void fatal [[noreturn]] (const char* fmt, ...);
 void warning (const char* fmt, ...);
+/* For non-problems worth telling about, like how long loading took */
+void info (const char* fmt, ...);
+
+/* Monotonic time in seconds, for measuring how long things take */
+double time_seconds ();
 
 template <class T>
 T ceil_po2 (T x)
@@ -51,6 +57,9 @@ void replace_with_last (T& container, int index)
 }
 
 
+/* Fast non-cryptographic hash, for telling if some data has changed */
+uint64_t hash_bytes (const void* data, size_t size, uint64_t seed = 0);
+
 bool str_any_of (const char* needle, std::initializer_list<const char*> haystack);
 
 #endif /* UTIL_H */
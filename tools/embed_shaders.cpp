@@ -0,0 +1,84 @@
+/*
+ * Expands every file of the shader directory as the app would, #line
+ * directives and all, and writes them out as a .cpp of string constants
+ * for glsl_source_cache_t::use_embedded(). Run by the Makefile:
+ *
+ *     embed_shaders shader/ bin/64/gen/shaders_embedded.cpp
+ *
+ * Source string numbers are used in the #line directives, as the app
+ * does unless gl_constants::GLSL_FILENAME_IN_LINE_DIRECTIVE is set
+ */
+#include "glsl_source.h"
+#include "util.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+
+/* As a string literal, a line at a time */
+static void write_literal (FILE* out, const std::string& s)
+{
+	fputs("\t\"", out);
+	for (size_t i = 0; i < s.size(); i++) {
+		const unsigned char c = s[i];
+		if (c == '\n')
+			fputs(i + 1 < s.size() ? "\\n\"\n\t\"" : "\\n", out);
+		else if (c == '\t')
+			fputs("\\t", out);
+		else if (c == '\\' || c == '"')
+			fprintf(out, "\\%c", c);
+		else if (c < ' ' || c > '~')
+			/* Always 3 digits, so that a digit after it isn't taken in */
+			fprintf(out, "\\%03o", c);
+		else
+			fputc(c, out);
+	}
+	fputs("\"", out);
+}
+
+int main (int argc, char** argv)
+{
+	if (argc != 3)
+		fatal("Usage: %s <shader dir> <output .cpp>", argv[0]);
+
+	std::string dir = argv[1];
+	if (!dir.empty() && dir.back() != '/')
+		dir += '/';
+
+	std::vector<std::string> names;
+	for (const auto& entry: std::filesystem::directory_iterator(dir)) {
+		if (entry.is_regular_file())
+			names.push_back(entry.path().filename().string());
+	}
+	/* So that the output only changes when the shaders do */
+	std::sort(names.begin(), names.end());
+
+	const std::string tmp_path = std::string(argv[2]) + ".tmp";
+	FILE* out = fopen(tmp_path.c_str(), "wb");
+	if (out == nullptr)
+		fatal("Cannot write %s", tmp_path.c_str());
+
+	fprintf(out, "/* Generated by tools/embed_shaders.cpp from %s, don't edit */\n", dir.c_str());
+	fprintf(out, "#include \"glsl_source.h\"\n\n");
+
+	glsl_source_cache_t sources(dir);
+	for (size_t i = 0; i < names.size(); i++) {
+		const glsl_source_t& src = sources.expand(names[i]);
+		fprintf(out, "/* %s */\nstatic constexpr char text_%zu[] =\n", names[i].c_str(), i);
+		write_literal(out, src.text);
+		fprintf(out, ";\n\n");
+	}
+
+	fprintf(out, "extern const glsl_embedded_shader_t glsl_embedded_shaders[] = {\n");
+	for (size_t i = 0; i < names.size(); i++) {
+		const glsl_source_t& src = sources.expand(names[i]);
+		fprintf(out, "\t{ \"%s\", text_%zu, \"%s\" },\n",
+				names[i].c_str(), i, src.reported_path.c_str());
+	}
+	fprintf(out, "};\n");
+	fprintf(out, "extern const int glsl_num_embedded_shaders = %zu;\n", names.size());
+
+	if (fclose(out) != 0)
+		fatal("Cannot write %s", tmp_path.c_str());
+	std::filesystem::rename(tmp_path, argv[2]);
+	return 0;
+}